@@ -39,8 +39,18 @@ typedef struct{
    TString pedestal_filename;
    TString total_signal_filename;
    TString dst_filename;
+   Int_t dst_binary;
    TString output_filename;
+   TString render_mode;
+   TString image_format;
    TString excluded_channels;
+   Int_t threads;
+   Int_t raw_cache;
+   Int_t batch_runs;
+   TString stats_filename;
+   Int_t follow_events;
+   Double_t follow_seconds;
+   Double_t follow_idle;
    Int_t debug_mode;
 }AnalysisConfig;
 
@@ -59,6 +69,8 @@ void generate_images(TList *, TString);
 
 TList* list_directory_files(TString dir_path, TString ext="");
 TList* list_from_textfile(TString textfile);
+TList* list_input_files(TString input, TString ext);
+TString list_file_path(TSystemFile* file);
 
 /******
 *
@@ -167,8 +179,18 @@ void parse_config_file(TString file_path, AnalysisConfig* config){
 	config->pedestal_filename = analysis_config.GetValue("pedestal-file", "temp1.raw");
 	config->total_signal_filename = analysis_config.GetValue("total-signal-file", "temp2.raw");
 	config->dst_filename = analysis_config.GetValue("dst-file", "temp.dst");
+	config->dst_binary = analysis_config.GetValue("dst-binary", 0); //also write the binary DST, searchable by timestamp, run and channel
 	config->output_filename = analysis_config.GetValue("output-file", "temp.pdf");
+	config->render_mode = analysis_config.GetValue("render-mode", "sync"); //sync, async or headless (only the DST)
+	config->image_format = analysis_config.GetValue("image-format", "pdf"); //pdf for a multipage PDF, png or svg for an image per channel
 	config->excluded_channels = analysis_config.GetValue("excluded_channels", "13");
+	config->threads = analysis_config.GetValue("threads", 0); //0 means all the cores
+	config->raw_cache = analysis_config.GetValue("raw-cache", 1); //binary cache next to the raw files
+	config->batch_runs = analysis_config.GetValue("batch-runs", 0); //concurrent runs in batch mode, 0 means all the cores
+	config->stats_filename = analysis_config.GetValue("stats-file", ""); //JSON report of each run appended here, also printed with debug_mode 2
+	config->follow_events = analysis_config.GetValue("follow-events", 10000); //follow mode: publish every follow-events new events
+	config->follow_seconds = analysis_config.GetValue("follow-seconds", 60.0); //or every follow-seconds seconds
+	config->follow_idle = analysis_config.GetValue("follow-idle", 0.0); //stop after follow-idle seconds without new events, 0 means never
 	config->debug_mode = analysis_config.GetValue("debug_mode", 0);
 	
 	if( config->debug_mode > 0){
@@ -292,4 +314,45 @@ TList* list_from_textfile(TString textfile){
 	return list_of_files;
 }
 
+
+/**
+* return a TList with the input files of a tool: the file itself if it has the extension,
+* all the files with the extension in a directory, or the files listed in a text file
+*
+* @param TString a file, a directory or a text file with a file path per line
+* @param TString extension of the input files, as ".raw"
+* @return a TList* to the list of files or NULL, paths are taken with list_file_path
+**/
+TList* list_input_files(TString input, TString ext){
+
+	TSystemFile file_name = TSystemFile(input.Data(), gSystem->DirName(input.Data()));
+
+	if( file_name.IsDirectory() ){
+		GGM_analysis_log( Form("Taking %s files from directory %s\n", ext.Data(), input.Data()) );
+		return list_directory_files(input, ext);
+	}
+
+	if( input.EndsWith(ext) ){
+		TList* list_of_files = new TList();
+		list_of_files->Add( new TSystemFile(input.Data(), "") );
+		return list_of_files;
+	}
+
+	GGM_analysis_log( Form("Taking %s files listed in %s\n", ext.Data(), input.Data()) );
+	return list_from_textfile(input);
+}
+
+
+/**
+* @param TSystemFile* element of a list from list_directory_files, list_from_textfile or list_input_files
+* @return path of the file, the name as it is when the file has no directory
+**/
+TString list_file_path(TSystemFile* file){
+
+	if( TString(file->GetTitle()).IsNull() )
+		return file->GetName();
+
+	return gSystem->ConcatFileName(file->GetTitle(), file->GetName());
+}
+
 #endif
\ No newline at end of file
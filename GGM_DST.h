@@ -0,0 +1,548 @@
+/*****
+*
+* header file with the DST output of the analysis
+*
+* the text DST has a line per channel:
+*   timestamp channel 0 0 0 0 efficiency HV
+* the HV of a channel is taken from the original DST of the run, ./DSToriginali/<dst>_l_3.dst,
+* which has 10 columns: column 2 is the channel (from zero), column 8 is the HV
+*
+* the binary DST (optional) has a DSTBinaryHeader and then fixed-size DSTRecord,
+* appended in order of timestamp and run, so a record can be found by timestamp, run and channel
+* with a binary search
+* the timestamp and the run number are assigned by commit_dst while the DST files are locked,
+* the timestamp is never before the last one in the DST and the run is the last one plus one
+*
+*******/
+#ifndef __GGM_DST__ //header guard lock
+#define __GGM_DST__
+
+#include <vector>
+#include <map>
+#include <mutex>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//ROOT headers
+#include "TTimeStamp.h"
+
+//custom headers
+#include "GGM_Analysis.h"
+#include "GGM_RawCache.h"
+
+
+#define DST_ORIGINAL_PATH "./DSToriginali/%s_l_3.dst" //original DST of a run, with the HV of the channels
+#define DST_ORIGINAL_COLUMNS 10 //how many columns in an original DST line
+#define DST_BINARY_EXTENSION ".dstb" //appended to the dst name for the binary DST
+#define DST_BINARY_MAGIC "GGMDSTB" //first bytes of a binary DST, with the null terminator
+#define DST_BINARY_VERSION 2
+
+
+/*
+* struct type definition for the HV of all the channels read from an original DST
+*/
+typedef struct{
+   TString file_path;
+   Long64_t source_size; //size of the original DST when it was read, -1 if missing
+   Long64_t source_mtime; //modification time of the original DST when it was read, in ns
+   Double_t hv[AVAILABLE_CHANNELS]; //channel[0] is channel 1, zero if not in the DST
+}HVTable;
+
+/*
+* struct type definition for a DST line, also the record of the binary DST
+*/
+typedef struct{
+   UInt_t timestamp;
+   UInt_t run; //from 1, only in the binary DST, it tells apart runs with the same timestamp
+   Int_t channel; //from 1
+   Int_t padding; //always zero
+   Double_t efficiency;
+   Double_t hv;
+}DSTRecord;
+
+/*
+* struct type definition for the header of a binary DST
+*/
+typedef struct{
+   char magic[8];
+   UInt_t version;
+   UInt_t record_size;
+}DSTBinaryHeader;
+
+/*
+* struct type definition for the DST lines of a run, written all together by commit_dst
+*/
+typedef struct{
+   TString dst_name;
+   HVTable* hv_table; //HV of the original DST of the run, read once for all the channels
+   UInt_t timestamp; //of the run, the same for every channel, set by commit_dst
+   UInt_t run; //run number in the binary DST, set by commit_dst, 0 if the binary DST is not written
+   vector<DSTRecord> records;
+}DSTBuffer;
+
+
+void init_dst_buffer(DSTBuffer* buffer, TString dst_name);
+void dst_add_channel(DSTBuffer* buffer, Int_t index, Double_t efficiency);
+Int_t commit_dst(DSTBuffer* buffer, Int_t binary = 0);
+TString dst_text_path(TString dst_name);
+TString dst_binary_path(TString dst_name);
+Int_t append_to_file(TString file_path, const char* data, Long64_t size, const char* header = NULL, Long64_t header_size = 0);
+int lock_file(TString file_path);
+Int_t write_locked_file(int fd, const char* data, Long64_t size, const char* header = NULL, Long64_t header_size = 0);
+UInt_t last_text_timestamp(int fd);
+Int_t last_binary_record(int fd, DSTRecord* record);
+
+HVTable* get_hv_table(TString dst_name);
+void read_hv_table(TString file_path, HVTable* table);
+
+Long64_t find_dst_record(TString dst_name, UInt_t timestamp, UInt_t run, Int_t channel, DSTRecord* record);
+
+
+/******
+*
+* global variable
+*******/
+std::mutex gGGM_HVTablesLock;
+std::map<TString, HVTable*> gGGM_HVTables; //original DSTs already read, by path, kept for the next runs
+
+
+
+/**
+* start the DST lines of a new run, the HV of the channels is taken now from the original DST
+*
+* @param DSTBuffer* buffer to initialize
+* @param TString name of the DST, as dst-file in the configuration file
+**/
+void init_dst_buffer(DSTBuffer* buffer, TString dst_name){
+
+	buffer->dst_name = dst_name;
+	buffer->hv_table = get_hv_table(dst_name);
+	buffer->timestamp = 0;
+	buffer->run = 0;
+	buffer->records.clear();
+}
+
+
+/**
+* add the line of a channel to the DST of the run, the HV is taken from the original DST
+*
+* @param DSTBuffer* buffer of the run
+* @param Int_t channel number, from 1
+* @param Double_t efficiency of the channel
+**/
+void dst_add_channel(DSTBuffer* buffer, Int_t index, Double_t efficiency){
+
+	DSTRecord record;
+	memset(&record, 0, sizeof(record)); //no garbage in the binary DST
+	record.channel = index;
+	record.efficiency = efficiency;
+	record.hv = ( index >= 1 && index <= AVAILABLE_CHANNELS ) ? buffer->hv_table->hv[index-1] : 0;
+
+	buffer->records.push_back(record);
+}
+
+
+/**
+* append all the lines of the run to the DST in a single write,
+* concurrent runs and readers never see a run half written
+* timestamp and run number are assigned while the DST files are locked, so the binary DST
+* is always in order of timestamp and run, even with concurrent runs and processes
+* the binary DST is optional: if it can't be written, or it's foreign or of another version,
+* it's skipped with a warning and only the text DST is written
+*
+* @param DSTBuffer* buffer of the run, emptied if the DST is written, timestamp and run are set
+* @param Int_t boolean: also append the records to the binary DST
+* @return boolean: true if the text DST was written
+**/
+Int_t commit_dst(DSTBuffer* buffer, Int_t binary){
+
+	if( buffer->records.empty() ){
+		return kTRUE;
+	}
+
+	//the text DST is always locked first, then the binary one
+	TString text_path = dst_text_path(buffer->dst_name);
+	int text_fd = lock_file(text_path);
+	if( text_fd == -1 ){
+		cerr << Form("ERROR: can't write dst file %s\n", text_path.Data());
+		return kFALSE;
+	}
+
+	TString binary_path = dst_binary_path(buffer->dst_name);
+	int binary_fd = -1;
+	DSTRecord last;
+	Int_t has_last = kFALSE;
+	if( binary ){
+		binary_fd = lock_file(binary_path);
+		has_last = ( binary_fd != -1 ) ? last_binary_record(binary_fd, &last) : -1;
+		if( has_last == -1 ){
+			cerr << Form("WARN: %s can't be read or is not a binary DST of version %d, only the text DST is written\n", binary_path.Data(), DST_BINARY_VERSION);
+			if( binary_fd != -1 )
+				close(binary_fd);
+			binary_fd = -1;
+			has_last = kFALSE;
+		}
+	}
+
+	TTimeStamp now;
+	UInt_t last_timestamp = last_text_timestamp(text_fd);
+	if( has_last && last.timestamp > last_timestamp )
+		last_timestamp = last.timestamp;
+
+	buffer->timestamp = TMath::Max((UInt_t)now.GetSec(), last_timestamp);
+	buffer->run = ( binary_fd == -1 ) ? 0 : ( has_last ? last.run + 1 : 1 );
+
+	TString lines;
+	for(UInt_t k=0; k < buffer->records.size(); k++){
+		DSTRecord *r = &buffer->records[k];
+		r->timestamp = buffer->timestamp;
+		r->run = buffer->run;
+		lines += Form("%u %d 0 0 0 0 %g %g\n", r->timestamp, r->channel, r->efficiency, r->hv);
+	}
+
+	Bool_t ok = write_locked_file(text_fd, lines.Data(), lines.Length());
+
+	if( ok && binary_fd != -1 ){
+		DSTBinaryHeader header;
+		memset(&header, 0, sizeof(header));
+		strcpy(header.magic, DST_BINARY_MAGIC);
+		header.version = DST_BINARY_VERSION;
+		header.record_size = sizeof(DSTRecord);
+
+		if( !write_locked_file(binary_fd, (const char*)&buffer->records[0], buffer->records.size()*sizeof(DSTRecord), (const char*)&header, sizeof(header)) )
+			cerr << Form("WARN: can't write dst file %s\n", binary_path.Data());
+	}
+
+	//the locks are released by close, the binary DST first
+	if( binary_fd != -1 && close(binary_fd) != 0 )
+		cerr << Form("WARN: can't write dst file %s\n", binary_path.Data());
+	ok = ( close(text_fd) == 0 ) && ok;
+
+	if( !ok ){
+		cerr << Form("ERROR: can't write dst file %s\n", text_path.Data());
+		return kFALSE;
+	}
+
+	buffer->records.clear();
+	return kTRUE;
+}
+
+
+/**
+* @param TString name of the DST, as dst-file in the configuration file
+* @return path of the text DST
+**/
+TString dst_text_path(TString dst_name){
+
+	if( dst_name.IsNull() )
+		return "temp.dst";
+
+	return Form("%s.dst", dst_name.Data());
+}
+
+
+/**
+* @param TString name of the DST, as dst-file in the configuration file
+* @return path of the binary DST
+**/
+TString dst_binary_path(TString dst_name){
+
+	if( dst_name.IsNull() )
+		return TString("temp") + DST_BINARY_EXTENSION;
+
+	return dst_name + DST_BINARY_EXTENSION;
+}
+
+
+/**
+* append data to a file with a single write under an exclusive lock,
+* the header is written first if the file is empty
+*
+* @param TString path of the file, created if missing
+* @param const char* data to append
+* @param Long64_t bytes of data
+* @param const char* header of a new file, NULL for none
+* @param Long64_t bytes of header
+* @return boolean: true if everything was written
+**/
+Int_t append_to_file(TString file_path, const char* data, Long64_t size, const char* header, Long64_t header_size){
+
+	int fd = lock_file(file_path);
+	if( fd == -1 ){
+		return kFALSE;
+	}
+
+	Bool_t ok = write_locked_file(fd, data, size, header, header_size);
+	ok = ( close(fd) == 0 ) && ok; //the lock is released by close
+
+	return ok;
+}
+
+
+/**
+* open a file for appending and take an exclusive lock on it, released when it's closed
+*
+* @param TString path of the file, created if missing
+* @return file descriptor, -1 if the file can't be opened
+**/
+int lock_file(TString file_path){
+
+	int fd = open(file_path.Data(), O_RDWR | O_APPEND | O_CREAT, 0644);
+	if( fd == -1 ){
+		return -1;
+	}
+
+	if( flock(fd, LOCK_EX) == -1 ){
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+
+/**
+* append data to a file opened by lock_file with a single write,
+* the header is written first if the file is empty
+*
+* @param int file descriptor from lock_file
+* @param const char* data to append
+* @param Long64_t bytes of data
+* @param const char* header of a new file, NULL for none
+* @param Long64_t bytes of header
+* @return boolean: true if everything was written
+**/
+Int_t write_locked_file(int fd, const char* data, Long64_t size, const char* header, Long64_t header_size){
+
+	struct stat info;
+	if( fstat(fd, &info) == -1 ){
+		return kFALSE;
+	}
+
+	vector<char> block;
+	if( header != NULL && info.st_size == 0 ){
+		block.insert(block.end(), header, header + header_size);
+	}
+	block.insert(block.end(), data, data + size);
+
+	return block.empty() || write(fd, &block[0], block.size()) == (ssize_t)block.size();
+}
+
+
+/**
+* @param int file descriptor of a text DST, from lock_file
+* @return timestamp of the last line, zero if the DST is empty
+**/
+UInt_t last_text_timestamp(int fd){
+
+	struct stat info;
+	if( fstat(fd, &info) == -1 || info.st_size == 0 ){
+		return 0;
+	}
+
+	//the last line is at the end of the file, a DST line is shorter than the tail read
+	char tail[512];
+	Long64_t offset = TMath::Max(0LL, (Long64_t)info.st_size - (Long64_t)sizeof(tail) + 1);
+	ssize_t n = pread(fd, tail, info.st_size - offset, offset);
+	if( n <= 0 ){
+		return 0;
+	}
+	tail[n] = '\0';
+
+	while( n > 0 && (tail[n-1] == '\n' || tail[n-1] == '\r') )
+		tail[--n] = '\0';
+
+	char* line = strrchr(tail, '\n');
+	line = ( line == NULL ) ? tail : line+1;
+
+	unsigned int timestamp = 0;
+	if( sscanf(line, "%u", &timestamp) != 1 ){
+		return 0;
+	}
+
+	return timestamp;
+}
+
+
+/**
+* read the last record of a binary DST, checking its header
+*
+* @param int file descriptor of a binary DST, from lock_file
+* @param DSTRecord* record, filled if the DST has records
+* @return 1 if the record was read, 0 if the DST has no records, -1 if it's not a binary DST of this version
+**/
+Int_t last_binary_record(int fd, DSTRecord* record){
+
+	struct stat info;
+	if( fstat(fd, &info) == -1 ){
+		return -1;
+	}
+	if( info.st_size == 0 ){
+		return 0;
+	}
+
+	DSTBinaryHeader header;
+	if( pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)
+		|| memcmp(header.magic, DST_BINARY_MAGIC, sizeof(DST_BINARY_MAGIC)) != 0
+		|| header.version != DST_BINARY_VERSION || header.record_size != sizeof(DSTRecord)
+		|| (info.st_size - sizeof(header)) % sizeof(DSTRecord) != 0 ){
+		return -1;
+	}
+
+	if( info.st_size == (Long64_t)sizeof(header) ){
+		return 0;
+	}
+
+	if( pread(fd, record, sizeof(DSTRecord), info.st_size - sizeof(DSTRecord)) != (ssize_t)sizeof(DSTRecord) ){
+		return -1;
+	}
+
+	return 1;
+}
+
+
+/**
+* get the HV table of the original DST of a run, reading it if it's new or changed
+* tables are kept until the end of the process, they are shared by all the runs:
+* a changed original DST is read in a new table, the old one may still be used by a run
+*
+* @param TString name of the DST, as dst-file in the configuration file
+* @return the HV table
+**/
+HVTable* get_hv_table(TString dst_name){
+
+	TString file_path = Form(DST_ORIGINAL_PATH, dst_name.Data());
+
+	struct stat info;
+	Long64_t size = -1, mtime = 0;
+	if( stat(file_path.Data(), &info) == 0 ){
+		size = info.st_size;
+		mtime = raw_cache_mtime(&info);
+	}
+
+	std::lock_guard<std::mutex> guard(gGGM_HVTablesLock);
+
+	HVTable *table = gGGM_HVTables[file_path];
+	if( table != NULL && table->source_size == size && table->source_mtime == mtime ){
+		return table;
+	}
+
+	table = new HVTable();
+	gGGM_HVTables[file_path] = table;
+	read_hv_table(file_path, table);
+	table->source_size = size;
+	table->source_mtime = mtime;
+
+	return table;
+}
+
+
+/**
+* read the HV of all the channels from an original DST,
+* the first line of a channel is taken, reading stops at the first malformed line
+*
+* @param TString path of the original DST
+* @param HVTable* table to fill
+**/
+void read_hv_table(TString file_path, HVTable* table){
+
+	table->file_path = file_path;
+	for(Int_t ch=0; ch < AVAILABLE_CHANNELS; ch++)
+		table->hv[ch] = 0;
+
+	Bool_t found[AVAILABLE_CHANNELS] = {kFALSE};
+	Double_t column[DST_ORIGINAL_COLUMNS]; //column 1 = channel index, column 7 = HV
+
+	ifstream in;
+	in.open(file_path.Data());
+
+	while( 1 ){
+		for(Int_t c=0; c < DST_ORIGINAL_COLUMNS; c++)
+			in >> column[c];
+		if( !in.good() )
+			break;
+
+		Int_t ch = TMath::Nint(column[1]);
+		if( ch != column[1] || ch < 0 || ch >= AVAILABLE_CHANNELS || found[ch] )
+			continue;
+
+		table->hv[ch] = column[7];
+		found[ch] = kTRUE;
+	}
+}
+
+
+/**
+* find the record of a channel in a run of the binary DST
+* records are in order of timestamp and run, the run is found with a binary search
+*
+* @param TString name of the DST, as dst-file in the configuration file
+* @param UInt_t timestamp of the run
+* @param UInt_t run number, as set by commit_dst and in the run report, 0 for the first run at this timestamp
+* @param Int_t channel number, from 1
+* @param DSTRecord* record, filled if found
+* @return index of the record in the binary DST, -1 if not found
+**/
+Long64_t find_dst_record(TString dst_name, UInt_t timestamp, UInt_t run, Int_t channel, DSTRecord* record){
+
+	TString binary_path = dst_binary_path(dst_name);
+	int fd = open(binary_path.Data(), O_RDONLY);
+	if( fd == -1 ){
+		return -1;
+	}
+
+	struct stat info;
+	if( fstat(fd, &info) == -1 || info.st_size < (Long64_t)sizeof(DSTBinaryHeader) ){
+		close(fd);
+		return -1;
+	}
+
+	char* data = (char*)mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); //the mapping keeps the file open
+	if( data == MAP_FAILED ){
+		return -1;
+	}
+
+	const DSTBinaryHeader* header = (const DSTBinaryHeader*)data;
+	if( memcmp(header->magic, DST_BINARY_MAGIC, sizeof(DST_BINARY_MAGIC)) != 0 || header->version != DST_BINARY_VERSION || header->record_size != sizeof(DSTRecord) ){
+		GGM_analysis_log( Form("WARN: %s is not a binary DST\n", binary_path.Data()) );
+		munmap(data, info.st_size);
+		return -1;
+	}
+
+	const DSTRecord* records = (const DSTRecord*)(data + sizeof(DSTBinaryHeader));
+	Long64_t n_records = (info.st_size - sizeof(DSTBinaryHeader)) / sizeof(DSTRecord);
+
+	//first record of the run
+	Long64_t low = 0, up = n_records;
+	while( low < up ){
+		Long64_t mid = low + (up-low)/2;
+		if( records[mid].timestamp < timestamp || (records[mid].timestamp == timestamp && records[mid].run < run) )
+			low = mid + 1;
+		else
+			up = mid;
+	}
+
+	//run 0 is the first run at this timestamp, readers of the text DST know only the timestamp
+	if( run == 0 && low < n_records && records[low].timestamp == timestamp )
+		run = records[low].run;
+
+	Long64_t index = -1;
+	for(Long64_t k=low; k < n_records && records[k].timestamp == timestamp && records[k].run == run; k++){
+		if( records[k].channel == channel ){
+			index = k;
+			*record = records[k];
+			break;
+		}
+	}
+
+	munmap(data, info.st_size);
+	return index;
+}
+
+#endif
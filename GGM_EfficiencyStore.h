@@ -0,0 +1,339 @@
+/*****
+*
+* header file with the aggregated store of the efficiency curve
+*
+* every DST file gives up to AVAILABLE_CHANNELS points (timestamp, HV, efficiency),
+* the points are kept by file with path, size and mtime of the file, so an update
+* parses again only the files new or modified since the last one
+*
+* the store is saved in a binary file:
+*   header (EfficiencyStoreHeader), then for each DST file
+*   path length, path, size, mtime, number of points, points
+*
+*******/
+#ifndef __GGM_EfficiencyStore__ //header guard lock
+#define __GGM_EfficiencyStore__
+
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <cstring>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+//ROOT headers
+#include "TMath.h"
+
+//custom headers
+#include "GGM_Analysis.h"
+#include "GGM_RawCache.h"
+#include "GGM_ThreadPool.h"
+
+
+#define EFFICIENCY_STORE_EXTENSION ".ggma" //appended to the DST list for the store file
+#define EFFICIENCY_STORE_NAME "efficiency_curve.ggma" //store file in a DST directory
+#define EFFICIENCY_STORE_MAGIC "GGMAGGR" //first bytes of a store file, with the null terminator
+#define EFFICIENCY_STORE_VERSION 1
+#define EFFICIENCY_STORE_BYTE_ORDER 0x01020304 //written as it is, read back different on a machine with another byte order
+#define DST_COLUMNS 10 //how many numbers in a DST row
+
+
+/*
+* struct type definition for a point of the efficiency curve
+*/
+typedef struct{
+   Int_t channel; //from zero
+   UInt_t timestamp;
+   Double_t hv;
+   Double_t efficiency;
+}EfficiencyPoint;
+
+/*
+* struct type definition for the points of a DST file
+*/
+typedef struct{
+   TString file_path;
+   Long64_t source_size; //size of the DST when it was parsed, -1 if it can't be read
+   Long64_t source_mtime; //modification time of the DST when it was parsed, in ns
+   vector<EfficiencyPoint> points;
+}DSTFilePoints;
+
+/*
+* struct type definition for the store, DST files by path
+*/
+typedef struct{
+   TString file_path; //where the store is saved
+   std::map<TString, DSTFilePoints> files;
+}EfficiencyStore;
+
+/*
+* struct type definition for the header of a store file
+*/
+typedef struct{
+   char magic[8];
+   UInt_t version;
+   UInt_t byte_order;
+   Long64_t n_files;
+}EfficiencyStoreHeader;
+
+
+Int_t update_efficiency_store(EfficiencyStore* store, TList* dst_file_list, Int_t n_threads = 0);
+void parse_dst_file(DSTFilePoints* dst);
+void efficiency_store_points(EfficiencyStore* store, TList* dst_file_list, vector< vector<double> >* array_hv_ch, vector< vector<double> >* array_eff_ch);
+Int_t read_efficiency_store(TString file_path, EfficiencyStore* store);
+Int_t write_efficiency_store(EfficiencyStore* store);
+TString dst_list_path(TSystemFile* file);
+
+
+
+/**
+* bring the store up to date with a list of DST files: files new or modified are parsed in parallel,
+* files not in the list any more are removed
+*
+* @param EfficiencyStore* store to update, read with read_efficiency_store
+* @param TList* list of TSystemFile, from list_directory_files or list_from_textfile
+* @param Int_t number of threads, 0 means all the cores
+* @return number of DST files parsed
+**/
+Int_t update_efficiency_store(EfficiencyStore* store, TList* dst_file_list, Int_t n_threads){
+
+	std::map<TString, DSTFilePoints> files;
+	vector<DSTFilePoints*> to_parse;
+
+	TListIter *dst_files_iter = (TListIter*)dst_file_list->MakeIterator(); //iterator object for the list
+	TSystemFile *file;
+	while ((file=(TSystemFile*)dst_files_iter->Next())) {
+
+		TString path = dst_list_path(file);
+		if( files.count(path) ) //listed twice
+			continue;
+
+		struct stat info;
+		Long64_t size = -1, mtime = 0;
+		if( stat(path.Data(), &info) == 0 ){
+			size = info.st_size;
+			mtime = raw_cache_mtime(&info);
+		}
+
+		DSTFilePoints &dst = files[path];
+		std::map<TString, DSTFilePoints>::iterator old = store->files.find(path);
+		if( size >= 0 && old != store->files.end() && old->second.source_size == size && old->second.source_mtime == mtime ){
+			dst.points.swap(old->second.points);
+		}else{
+			to_parse.push_back(&dst);
+		}
+		dst.file_path = path;
+		dst.source_size = size;
+		dst.source_mtime = mtime;
+	}
+
+	run_parallel(to_parse.size(), n_threads, [&](Int_t k){
+		parse_dst_file(to_parse[k]);
+	});
+
+	store->files.swap(files);
+
+	return to_parse.size();
+}
+
+
+/**
+* read the points of a DST file, as the efficiency curve always did:
+* the first row is skipped, then up to AVAILABLE_CHANNELS rows are taken,
+* HV and efficiency are divided by 100
+* rows with a channel out of range are skipped, an incomplete last row is ignored
+*
+* @param DSTFilePoints* file to parse, the path is already set, source_size is -1 if it can't be read
+**/
+void parse_dst_file(DSTFilePoints* dst){
+
+	dst->points.clear();
+
+	ifstream dst_file( dst->file_path.Data(), ifstream::in); //open file in only-read mode
+	if( !dst_file.good() ){
+		dst->source_size = -1;
+		return;
+	}
+
+	Double_t column[DST_COLUMNS]; //column 0 = timestamp, 1 = channel, 6 = efficiency, 7 = HV
+	Int_t rows = 0;
+
+	while( rows <= AVAILABLE_CHANNELS ){
+
+		for(Int_t c=0; c < DST_COLUMNS; c++)
+			dst_file >> column[c];
+		if( dst_file.fail() )
+			break;
+
+		if( rows++ == 0 ) //first row is not a channel
+			continue;
+
+		Int_t ch = TMath::Nint(column[1]);
+		if( ch != column[1] || ch < 0 || ch >= AVAILABLE_CHANNELS )
+			continue;
+
+		EfficiencyPoint point;
+		point.channel = ch;
+		point.timestamp = (UInt_t)column[0];
+		point.hv = column[7]/100;
+		point.efficiency = column[6]/100;
+		dst->points.push_back(point);
+	}
+}
+
+
+/**
+* fill the HV and efficiency vectors of each channel, in the order of the DST list
+*
+* @param EfficiencyStore* store up to date with the list
+* @param TList* list of TSystemFile
+* @param vector< vector<double> >* HV of each channel
+* @param vector< vector<double> >* efficiency of each channel
+**/
+void efficiency_store_points(EfficiencyStore* store, TList* dst_file_list, vector< vector<double> >* array_hv_ch, vector< vector<double> >* array_eff_ch){
+
+	array_hv_ch->assign(AVAILABLE_CHANNELS, vector<double>());
+	array_eff_ch->assign(AVAILABLE_CHANNELS, vector<double>());
+
+	std::map<TString, Int_t> used; //a file listed twice gives its points once
+
+	TListIter *dst_files_iter = (TListIter*)dst_file_list->MakeIterator(); //iterator object for the list
+	TSystemFile *file;
+	while ((file=(TSystemFile*)dst_files_iter->Next())) {
+
+		TString path = dst_list_path(file);
+		std::map<TString, DSTFilePoints>::iterator dst = store->files.find(path);
+		if( dst == store->files.end() || used[path]++ > 0 )
+			continue;
+
+		if( dst->second.source_size < 0 ){
+			GGM_analysis_log( Form("WARN: skipped file %s ...\n ", path.Data()) );
+			continue;
+		}
+
+		for(UInt_t k=0; k < dst->second.points.size(); k++){
+			EfficiencyPoint *point = &dst->second.points[k];
+			(*array_hv_ch)[point->channel].push_back( point->hv );
+			(*array_eff_ch)[point->channel].push_back( point->efficiency );
+		}
+	}
+}
+
+
+/**
+* read a store file, a missing or broken file gives an empty store
+*
+* @param TString path of the store file, also where write_efficiency_store will save it
+* @param EfficiencyStore* store to fill
+* @return number of DST files in the store, -1 if the file is missing or broken
+**/
+Int_t read_efficiency_store(TString file_path, EfficiencyStore* store){
+
+	store->file_path = file_path;
+	store->files.clear();
+
+	FILE* f = fopen(file_path.Data(), "rb");
+	if( f == NULL ){
+		return -1;
+	}
+
+	EfficiencyStoreHeader header;
+	Bool_t ok = ( fread(&header, sizeof(header), 1, f) == 1 )
+		&& memcmp(header.magic, EFFICIENCY_STORE_MAGIC, sizeof(EFFICIENCY_STORE_MAGIC)) == 0
+		&& header.version == EFFICIENCY_STORE_VERSION
+		&& header.byte_order == EFFICIENCY_STORE_BYTE_ORDER;
+
+	for(Long64_t k=0; ok && k < header.n_files; k++){
+		UInt_t path_length = 0;
+		Long64_t n_points = 0;
+		DSTFilePoints dst;
+
+		ok = ( fread(&path_length, sizeof(path_length), 1, f) == 1 ) && path_length < 65536;
+		vector<char> path(path_length+1, '\0');
+		ok = ok && fread(&path[0], 1, path_length, f) == path_length;
+		ok = ok && fread(&dst.source_size, sizeof(Long64_t), 1, f) == 1;
+		ok = ok && fread(&dst.source_mtime, sizeof(Long64_t), 1, f) == 1;
+		ok = ok && fread(&n_points, sizeof(Long64_t), 1, f) == 1 && n_points >= 0 && n_points <= AVAILABLE_CHANNELS;
+		if( ok && n_points > 0 ){
+			dst.points.resize(n_points);
+			ok = fread(&dst.points[0], sizeof(EfficiencyPoint), n_points, f) == (size_t)n_points;
+		}
+
+		if( ok ){
+			dst.file_path = &path[0];
+			store->files[dst.file_path] = dst;
+		}
+	}
+	fclose(f);
+
+	if( !ok ){
+		GGM_analysis_log( Form("WARN: store %s is broken, every DST file will be parsed again\n", file_path.Data()) );
+		store->files.clear();
+		return -1;
+	}
+
+	return store->files.size();
+}
+
+
+/**
+* save the store in its file, written in a temporary file and renamed
+*
+* @param EfficiencyStore* store to save
+* @return boolean: true if the store was written
+**/
+Int_t write_efficiency_store(EfficiencyStore* store){
+
+	TString temp_path = Form("%s.%d.tmp", store->file_path.Data(), getpid());
+
+	FILE* f = fopen(temp_path.Data(), "wb");
+	if( f == NULL ){
+		GGM_analysis_log( Form("WARN: can't write store %s\n", store->file_path.Data()) );
+		return kFALSE;
+	}
+
+	EfficiencyStoreHeader header;
+	memset(&header, 0, sizeof(header));
+	strcpy(header.magic, EFFICIENCY_STORE_MAGIC);
+	header.version = EFFICIENCY_STORE_VERSION;
+	header.byte_order = EFFICIENCY_STORE_BYTE_ORDER;
+	header.n_files = store->files.size();
+
+	Bool_t ok = ( fwrite(&header, sizeof(header), 1, f) == 1 );
+
+	std::map<TString, DSTFilePoints>::iterator dst;
+	for(dst = store->files.begin(); ok && dst != store->files.end(); dst++){
+		UInt_t path_length = dst->second.file_path.Length();
+		Long64_t n_points = dst->second.points.size();
+
+		ok = fwrite(&path_length, sizeof(path_length), 1, f) == 1;
+		ok = ok && fwrite(dst->second.file_path.Data(), 1, path_length, f) == path_length;
+		ok = ok && fwrite(&dst->second.source_size, sizeof(Long64_t), 1, f) == 1;
+		ok = ok && fwrite(&dst->second.source_mtime, sizeof(Long64_t), 1, f) == 1;
+		ok = ok && fwrite(&n_points, sizeof(Long64_t), 1, f) == 1;
+		if( n_points > 0 )
+			ok = ok && fwrite(&dst->second.points[0], sizeof(EfficiencyPoint), n_points, f) == (size_t)n_points;
+	}
+	ok = ( fclose(f) == 0 ) && ok;
+
+	if( !ok || rename(temp_path.Data(), store->file_path.Data()) != 0 ){
+		GGM_analysis_log( Form("WARN: can't write store %s\n", store->file_path.Data()) );
+		unlink(temp_path.Data());
+		return kFALSE;
+	}
+
+	return kTRUE;
+}
+
+
+/**
+* @param TSystemFile* element of a list from list_directory_files or list_from_textfile
+* @return path of the file, relative paths of a text list are kept as they are
+**/
+TString dst_list_path(TSystemFile* file){
+
+	return list_file_path(file);
+}
+
+#endif
@@ -0,0 +1,517 @@
+/*****
+*
+* header file with the fused histogram engine
+*
+* every channel of a raw data file is reduced in a single pass to the list of
+* distinct integer ADC values with their counts, any fixed binning histogram
+* of a channel is then built from the counts without reading the events again
+* the counts are also an exact quantile summary of the channel
+*
+*******/
+#ifndef __GGM_Histogram__ //header guard lock
+#define __GGM_Histogram__
+
+#include <vector>
+#include <algorithm>
+
+//ROOT headers
+#include "TH1F.h"
+#include "TMath.h"
+
+//custom headers
+#include "GGM_Analysis.h"
+#include "GGM_RawData.h"
+#include "GGM_RawCache.h"
+#include "GGM_ThreadPool.h"
+
+
+#define ADC_RANGE 65536 //ADC counts are expected in [0, ADC_RANGE), values outside are counted apart
+#define RAW_LOAD_LIMIT (2LL*1024*1024*1024) //raw files bigger than this are streamed instead of loaded
+
+
+/*
+* struct type definition for the counts of one ADC channel
+* value is sorted ascending, count[k] is the number of events with ADC value[k]
+* quartile and the summary are filled by summarize_counts when all the events are counted
+*/
+typedef struct{
+   Long64_t entries;
+   vector<Int_t> value;
+   vector<Long64_t> count;
+   Double_t quartile[3]; //first quartile, median, third quartile
+   Int_t min;
+   Int_t max;
+}ChannelCounts;
+
+/*
+* struct type definition for a fixed binning histogram filled event by event, without ROOT objects
+* content has underflow and overflow, stats are sumw, sumw2, sumwx, sumwx2 of the events in range
+*/
+typedef struct{
+   Int_t nbins;
+   Double_t low;
+   Double_t up;
+   Double_t offset; //value subtracted to each ADC count before filling
+   vector<Double_t> content;
+   Double_t stats[4];
+   Long64_t entries;
+}BinnedChannel;
+
+
+Long64_t count_raw_file(TString file_path, ChannelCounts* counts, Int_t n_threads = 0, Int_t use_cache = 0);
+Long64_t count_raw_cache(TString file_path, ChannelCounts* counts, Int_t n_threads = 0);
+void build_channel_counts(RawChannelStore* store, ChannelCounts* counts, Int_t n_threads = 0);
+void count_channel(const Int_t* adc, Long64_t n, ChannelCounts* counts);
+void merge_channel_counts(ChannelCounts* counts, const vector<Int_t>& value, const vector<Long64_t>& count);
+void clear_channel_counts(ChannelCounts* counts);
+void summarize_counts(ChannelCounts* counts);
+
+void counts_quantiles(const ChannelCounts* counts, Int_t n, Double_t* q, const Double_t* p);
+Double_t counts_rms(const ChannelCounts* counts, Double_t low, Double_t up);
+
+TH1F* histogram_from_counts(TString name, TString title, const ChannelCounts* counts, Int_t nbins, Double_t low, Double_t up, Double_t offset = 0);
+
+void init_binned_channel(BinnedChannel* binned, Int_t nbins, Double_t low, Double_t up, Double_t offset = 0);
+void fill_binned_channel(BinnedChannel* binned, const Int_t* adc, Long64_t n);
+void fill_binned_value(BinnedChannel* binned, Int_t value, Long64_t count);
+TH1F* histogram_from_binned(TString name, TString title, const BinnedChannel* binned);
+
+
+
+/**
+* read a raw data file and count the ADC values of all the channels
+* with use_cache a fresh binary cache is used instead of the raw file, and a missing
+* or stale one is written again
+* files up to RAW_LOAD_LIMIT bytes are memory-mapped, bigger ones are streamed in blocks
+* the events are kept in a single store only to write the cache, else each block is counted and freed
+*
+* @param TString path to the raw data file
+* @param ChannelCounts* array of AVAILABLE_CHANNELS counts to fill
+* @param Int_t number of threads, 0 means all the cores
+* @param Int_t boolean: read and write the binary cache of the raw file
+* @return number of events read, -1 if the file can't be read
+**/
+Long64_t count_raw_file(TString file_path, ChannelCounts* counts, Int_t n_threads, Int_t use_cache){
+
+	for(Int_t ch=0; ch < AVAILABLE_CHANNELS; ch++)
+		clear_channel_counts(&counts[ch]);
+
+	Long_t id, flags, modtime;
+	Long64_t size;
+	if( gSystem->GetPathInfo(file_path.Data(), &id, &size, &flags, &modtime) != 0 ){
+		GGM_analysis_log( Form("ERROR: can't open file %s\n", file_path.Data()) );
+		return -1;
+	}
+
+	//counts of each block of events are merged in the totals
+	struct StreamCounts{
+		ChannelCounts* counts;
+		Int_t n_threads;
+		static void add_block(RawChannelStore* block, void* user_data){
+			StreamCounts* self = (StreamCounts*)user_data;
+			ChannelCounts block_counts[AVAILABLE_CHANNELS];
+			build_channel_counts(block, block_counts, self->n_threads);
+			for(Int_t ch=0; ch < AVAILABLE_CHANNELS; ch++){
+				merge_channel_counts(&self->counts[ch], block_counts[ch].value, block_counts[ch].count);
+				self->counts[ch].entries += block_counts[ch].entries;
+			}
+		}
+	} stream_counts = { counts, n_threads };
+
+	if( use_cache && count_raw_cache(file_path, counts, n_threads) > 0 ){
+		GGM_analysis_log( Form("%s read from cache\n", file_path.Data()) );
+
+	}else if( size <= RAW_LOAD_LIMIT && use_cache ){
+		//the cache needs all the columns of the file in a single store
+		struct stat raw_info;
+		RawChannelStore* store = load_raw_file(file_path, n_threads, &raw_info);
+		if( store == NULL )
+			return -1;
+
+		build_channel_counts(store, counts, n_threads);
+		write_raw_cache(file_path, store, &raw_info);
+		delete store;
+
+	}else if( size <= RAW_LOAD_LIMIT ){
+		//the events of each parser thread are counted and freed, the columns are never merged
+		if( parse_raw_file(file_path, StreamCounts::add_block, &stream_counts, n_threads) <= 0 )
+			return -1;
+
+	}else{
+		GGM_analysis_log( Form("%s is %lld bytes, streaming it\n", file_path.Data(), size) );
+
+		if( stream_raw_file(file_path, StreamCounts::add_block, &stream_counts, n_threads) <= 0 )
+			return -1;
+	}
+
+	for(Int_t ch=0; ch < AVAILABLE_CHANNELS; ch++)
+		summarize_counts(&counts[ch]);
+
+	return counts[0].entries;
+}
+
+
+/**
+* count the ADC values of all the channels from the fresh cache of a raw file,
+* the columns are read straight from the mapped cache
+* a constant channel (min equal to max in the header) is counted without reading its column
+*
+* @param TString path to the raw data file
+* @param ChannelCounts* array of AVAILABLE_CHANNELS counts to fill
+* @param Int_t number of threads, 0 means all the cores
+* @return number of events, -1 if there is no fresh cache
+**/
+Long64_t count_raw_cache(TString file_path, ChannelCounts* counts, Int_t n_threads){
+
+	RawCacheFile* cache = open_raw_cache(file_path);
+	if( cache == NULL ){
+		return -1;
+	}
+
+	const RawCacheHeader* header = cache->header;
+	run_parallel(AVAILABLE_CHANNELS, n_threads, [&](Int_t ch){
+		clear_channel_counts(&counts[ch]);
+		if( header->entries == 0 )
+			return;
+
+		if( header->min[ch] == header->max[ch] ){
+			counts[ch].value.push_back(header->min[ch]);
+			counts[ch].count.push_back(header->entries);
+			counts[ch].entries = header->entries;
+		}else{
+			count_channel(cache->channel[ch], header->entries, &counts[ch]);
+		}
+	});
+
+	Long64_t entries = header->entries;
+	close_raw_cache(cache);
+
+	return entries;
+}
+
+
+/**
+* count the ADC values of all the channels of a store, one channel per thread
+*
+* @param RawChannelStore* store with raw data
+* @param ChannelCounts* array of AVAILABLE_CHANNELS counts to fill
+* @param Int_t number of threads, 0 means all the cores
+**/
+void build_channel_counts(RawChannelStore* store, ChannelCounts* counts, Int_t n_threads){
+
+	run_parallel(AVAILABLE_CHANNELS, n_threads, [&](Int_t ch){
+		clear_channel_counts(&counts[ch]);
+		if( store->entries > 0 )
+			count_channel(&store->channel[ch][0], store->entries, &counts[ch]);
+	});
+}
+
+
+/**
+* count the ADC values of one channel and merge them in counts
+*
+* @param const Int_t* ADC values
+* @param Long64_t number of values
+* @param ChannelCounts* counts to update
+**/
+void count_channel(const Int_t* adc, Long64_t n, ChannelCounts* counts){
+
+	vector<UInt_t> dense(ADC_RANGE, 0);
+	vector<Int_t> outside; //values outside [0, ADC_RANGE)
+
+	for(Long64_t k=0; k < n; k++){
+		UInt_t v = (UInt_t)adc[k];
+		if( v < ADC_RANGE )
+			dense[v]++;
+		else
+			outside.push_back(adc[k]);
+	}
+
+	//sorted list of distinct values, with the values outside the range in their place
+	std::sort(outside.begin(), outside.end());
+
+	vector<Int_t> value;
+	vector<Long64_t> count;
+	UInt_t k = 0;
+	while( k < outside.size() && outside[k] < 0 ){
+		if( value.empty() || value.back() != outside[k] ){
+			value.push_back(outside[k]);
+			count.push_back(0);
+		}
+		count.back()++;
+		k++;
+	}
+	for(Int_t v=0; v < ADC_RANGE; v++){
+		if( dense[v] > 0 ){
+			value.push_back(v);
+			count.push_back(dense[v]);
+		}
+	}
+	while( k < outside.size() ){
+		if( value.empty() || value.back() != outside[k] ){
+			value.push_back(outside[k]);
+			count.push_back(0);
+		}
+		count.back()++;
+		k++;
+	}
+
+	merge_channel_counts(counts, value, count);
+	counts->entries += n;
+}
+
+
+/**
+* merge a sorted list of values and counts in counts, entries are not updated
+*
+* @param ChannelCounts* counts to update
+* @param vector<Int_t> sorted distinct values
+* @param vector<Long64_t> count for each value
+**/
+void merge_channel_counts(ChannelCounts* counts, const vector<Int_t>& value, const vector<Long64_t>& count){
+
+	if( counts->value.empty() ){
+		counts->value = value;
+		counts->count = count;
+		return;
+	}
+
+	vector<Int_t> merged_value;
+	vector<Long64_t> merged_count;
+	merged_value.reserve(counts->value.size() + value.size());
+	merged_count.reserve(counts->value.size() + value.size());
+
+	UInt_t a = 0, b = 0;
+	while( a < counts->value.size() || b < value.size() ){
+		if( b == value.size() || (a < counts->value.size() && counts->value[a] < value[b]) ){
+			merged_value.push_back(counts->value[a]);
+			merged_count.push_back(counts->count[a]);
+			a++;
+		}else if( a == counts->value.size() || value[b] < counts->value[a] ){
+			merged_value.push_back(value[b]);
+			merged_count.push_back(count[b]);
+			b++;
+		}else{
+			merged_value.push_back(value[b]);
+			merged_count.push_back(counts->count[a] + count[b]);
+			a++;
+			b++;
+		}
+	}
+
+	counts->value.swap(merged_value);
+	counts->count.swap(merged_count);
+}
+
+
+/**
+* @param ChannelCounts* counts to empty
+**/
+void clear_channel_counts(ChannelCounts* counts){
+
+	counts->entries = 0;
+	counts->value.clear();
+	counts->count.clear();
+	counts->quartile[0] = counts->quartile[1] = counts->quartile[2] = 0;
+	counts->min = counts->max = 0;
+}
+
+
+/**
+* fill quartiles, min and max of a channel from its counts
+*
+* @param ChannelCounts* counts of the channel
+**/
+void summarize_counts(ChannelCounts* counts){
+
+	Double_t p[3] = {0.25, 0.5, 0.75};
+	counts_quantiles(counts, 3, counts->quartile, p);
+
+	if( counts->value.empty() ){
+		counts->min = counts->max = 0;
+		return;
+	}
+
+	counts->min = counts->value.front();
+	counts->max = counts->value.back();
+}
+
+
+/**
+* exact quantiles of the ADC values of a channel:
+* the quantile p is the smallest value with at least p*entries events less or equal to it
+*
+* @param const ChannelCounts* counts of the channel
+* @param Int_t number of quantiles
+* @param Double_t* array of n quantiles to fill, zero if there are no counts
+* @param const Double_t* array of n probabilities in [0,1], sorted ascending
+**/
+void counts_quantiles(const ChannelCounts* counts, Int_t n, Double_t* q, const Double_t* p){
+
+	Long64_t k = 0;
+	Long64_t cumulative = 0;
+	Long64_t n_values = counts->value.size();
+
+	for(Int_t i=0; i < n; i++){
+		if( n_values == 0 ){
+			q[i] = 0;
+			continue;
+		}
+
+		Double_t target = p[i]*counts->entries;
+		while( k < n_values-1 && cumulative + counts->count[k] < target ){
+			cumulative += counts->count[k];
+			k++;
+		}
+		q[i] = counts->value[k];
+	}
+}
+
+
+/**
+* RMS of the ADC values of a channel in [low, up),
+* the same of GetRMS of a histogram filled with the channel in that range
+*
+* @param const ChannelCounts* counts of the channel
+* @param Double_t lower edge
+* @param Double_t upper edge
+* @return RMS, zero if there are no values in range
+**/
+Double_t counts_rms(const ChannelCounts* counts, Double_t low, Double_t up){
+
+	Double_t sumw = 0, sumwx = 0, sumwx2 = 0;
+	for(UInt_t k=0; k < counts->value.size(); k++){
+		Double_t x = counts->value[k];
+		if( x < low || !(x < up) )
+			continue;
+
+		sumw += counts->count[k];
+		sumwx += counts->count[k]*x;
+		sumwx2 += counts->count[k]*x*x;
+	}
+
+	if( sumw == 0 )
+		return 0;
+
+	Double_t mean = sumwx/sumw;
+	return TMath::Sqrt( TMath::Abs(sumwx2/sumw - mean*mean) );
+}
+
+
+/**
+* build a fixed binning histogram from the counts of a channel,
+* bin contents and statistics are the same of filling it event by event
+* the histogram is not attached to any directory, it's owned by the caller
+*
+* @param TString histogram name
+* @param TString histogram title
+* @param const ChannelCounts* counts of the channel
+* @param Int_t number of bins
+* @param Double_t lower edge
+* @param Double_t upper edge
+* @param Double_t value subtracted to each ADC count before filling
+* @return the new histogram
+**/
+TH1F* histogram_from_counts(TString name, TString title, const ChannelCounts* counts, Int_t nbins, Double_t low, Double_t up, Double_t offset){
+
+	BinnedChannel binned;
+	init_binned_channel(&binned, nbins, low, up, offset);
+
+	for(UInt_t k=0; k < counts->value.size(); k++)
+		fill_binned_value(&binned, counts->value[k], counts->count[k]);
+	binned.entries = counts->entries;
+
+	return histogram_from_binned(name, title, &binned);
+}
+
+
+/**
+* prepare an empty fixed binning histogram
+*
+* @param BinnedChannel* histogram to initialize
+* @param Int_t number of bins
+* @param Double_t lower edge
+* @param Double_t upper edge
+* @param Double_t value subtracted to each ADC count before filling
+**/
+void init_binned_channel(BinnedChannel* binned, Int_t nbins, Double_t low, Double_t up, Double_t offset){
+
+	binned->nbins = nbins;
+	binned->low = low;
+	binned->up = up;
+	binned->offset = offset;
+	binned->content.assign(nbins+2, 0);
+	for(Int_t k=0; k < 4; k++)
+		binned->stats[k] = 0;
+	binned->entries = 0;
+}
+
+
+/**
+* add events to a histogram, the work is proportional to the new events only
+*
+* @param BinnedChannel* histogram to fill
+* @param const Int_t* ADC counts of the new events
+* @param Long64_t number of new events
+**/
+void fill_binned_channel(BinnedChannel* binned, const Int_t* adc, Long64_t n){
+
+	for(Long64_t k=0; k < n; k++)
+		fill_binned_value(binned, adc[k], 1);
+	binned->entries += n;
+}
+
+
+/**
+* add count events with the same ADC value to a histogram, entries are not changed
+*
+* @param BinnedChannel* histogram to fill
+* @param Int_t ADC count
+* @param Long64_t number of events
+**/
+void fill_binned_value(BinnedChannel* binned, Int_t value, Long64_t count){
+
+	//bin of the value, same rule as TAxis::FindFixBin for fixed bins
+	Double_t x = value - binned->offset;
+	Int_t nbins = binned->nbins;
+	Int_t b = 1 + (Int_t)(nbins*(x-binned->low)/(binned->up-binned->low));
+	b = (x < binned->low) ? 0 : ( !(x < binned->up) ? nbins+1 : b );
+
+	//bin contents and in range statistics
+	binned->content[b] += count;
+	if( b > 0 && b <= nbins ){
+		binned->stats[0] += count;
+		binned->stats[1] += count;
+		binned->stats[2] += count*x;
+		binned->stats[3] += count*x*x;
+	}
+}
+
+
+/**
+* build a ROOT histogram from a fixed binning histogram,
+* bin contents and statistics are the same of filling it event by event
+* the histogram is not attached to any directory, it's owned by the caller
+*
+* @param TString histogram name
+* @param TString histogram title
+* @param const BinnedChannel* histogram filled with fill_binned_channel or fill_binned_value
+* @return the new histogram
+**/
+TH1F* histogram_from_binned(TString name, TString title, const BinnedChannel* binned){
+
+	TH1F *hist = new TH1F(name, title, binned->nbins, binned->low, binned->up);
+	hist->SetDirectory(0);
+
+	for(Int_t b=0; b <= binned->nbins+1; b++)
+		hist->SetBinContent(b, binned->content[b]);
+
+	Double_t stats[4] = {binned->stats[0], binned->stats[1], binned->stats[2], binned->stats[3]};
+	hist->PutStats(stats);
+	hist->SetEntries(binned->entries);
+
+	return hist;
+}
+
+
+#endif
@@ -0,0 +1,315 @@
+/*****
+*
+* header file with the binary columnar cache of raw data files
+*
+* the cache of file.raw is file.raw.ggmc, next to it:
+*   header (RawCacheHeader) with event count, size and mtime of the raw file
+*   and min/max of each channel
+*   event_id column, then channel_1 ... channel_16 columns
+* every column is little-endian, 4 bytes per event, padded to 8 bytes
+* the cache is fresh when size and mtime of the raw file are the same of the header
+*
+*******/
+#ifndef __GGM_RawCache__ //header guard lock
+#define __GGM_RawCache__
+
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//custom headers
+#include "GGM_Analysis.h"
+#include "GGM_RawData.h"
+
+
+#define RAW_CACHE_EXTENSION ".ggmc" //appended to the raw file name
+#define RAW_CACHE_MAGIC "GGMRAWC" //first bytes of a cache file, with the null terminator
+#define RAW_CACHE_VERSION 2
+
+
+/*
+* struct type definition for the header of a cache file
+*/
+typedef struct{
+   char magic[8];
+   UInt_t version;
+   UInt_t channels;
+   Long64_t entries;
+   Long64_t source_size; //size of the raw file when the cache was written
+   Long64_t source_mtime; //modification time of the raw file when the cache was written, in ns
+   Int_t min[AVAILABLE_CHANNELS];
+   Int_t max[AVAILABLE_CHANNELS];
+}RawCacheHeader;
+
+/*
+* struct type definition for an open cache file, columns point into the mapping
+*/
+typedef struct{
+   TString file_path;
+   char* data;
+   Long64_t size;
+   const RawCacheHeader* header;
+   const UInt_t* event_id;
+   const Int_t* channel[AVAILABLE_CHANNELS];
+}RawCacheFile;
+
+
+TString raw_cache_path(TString raw_path);
+Int_t raw_cache_is_fresh(TString raw_path);
+Int_t write_raw_cache(TString raw_path, RawChannelStore* store, const struct stat* raw_info);
+Int_t build_raw_cache(TString raw_path, Int_t n_threads = 0);
+RawCacheFile* open_raw_cache(TString raw_path);
+void close_raw_cache(RawCacheFile* cache);
+Long64_t raw_cache_column_size(Long64_t entries);
+Long64_t raw_cache_mtime(const struct stat* info);
+
+
+
+/**
+* @param TString path to the raw data file
+* @return path to its cache file
+**/
+TString raw_cache_path(TString raw_path){
+
+	return raw_path + RAW_CACHE_EXTENSION;
+}
+
+
+/**
+* @param Long64_t number of events
+* @return bytes of a column in the cache, padded to 8 bytes
+**/
+Long64_t raw_cache_column_size(Long64_t entries){
+
+	return ((entries*sizeof(Int_t) + 7)/8)*8;
+}
+
+
+/**
+* @param const struct stat* information of a file
+* @return modification time in nanoseconds, so a rewrite in the same second is noticed
+**/
+Long64_t raw_cache_mtime(const struct stat* info){
+
+	return (Long64_t)info->st_mtim.tv_sec*1000000000LL + info->st_mtim.tv_nsec;
+}
+
+
+/**
+* check if the cache of a raw file exists and was written from the current raw file
+*
+* @param TString path to the raw data file
+* @return boolean: true if the cache can be used
+**/
+Int_t raw_cache_is_fresh(TString raw_path){
+
+	struct stat raw_info;
+	if( stat(raw_path.Data(), &raw_info) == -1 ){
+		return kFALSE;
+	}
+
+	FILE* f = fopen(raw_cache_path(raw_path).Data(), "rb");
+	if( f == NULL ){
+		return kFALSE;
+	}
+
+	RawCacheHeader header;
+	Bool_t read = ( fread(&header, sizeof(header), 1, f) == 1 );
+	fclose(f);
+
+	UInt_t one = 1;
+	Bool_t little_endian = ( *(char*)&one == 1 );
+
+	return little_endian && read
+		&& memcmp(header.magic, RAW_CACHE_MAGIC, sizeof(RAW_CACHE_MAGIC)) == 0
+		&& header.version == RAW_CACHE_VERSION
+		&& header.channels == AVAILABLE_CHANNELS
+		&& header.source_size == raw_info.st_size
+		&& header.source_mtime == raw_cache_mtime(&raw_info);
+}
+
+
+/**
+* write the cache of a raw file from its store,
+* the cache is written in a temporary file and renamed, readers never see it half written
+* it's not written if the raw file changed since it was read, the cache would look fresh
+*
+* @param TString path to the raw data file the store was read from
+* @param RawChannelStore* store with all the events of the raw file
+* @param const struct stat* information of the raw file taken before it was read, by load_raw_file
+* @return boolean: true if the cache was written
+**/
+Int_t write_raw_cache(TString raw_path, RawChannelStore* store, const struct stat* raw_info){
+
+	struct stat now_info;
+	if( stat(raw_path.Data(), &now_info) == -1 ){
+		return kFALSE;
+	}
+
+	if( now_info.st_size != raw_info->st_size || raw_cache_mtime(&now_info) != raw_cache_mtime(raw_info) ){
+		GGM_analysis_log( Form("WARN: %s changed while it was read, cache not written\n", raw_path.Data()) );
+		return kFALSE;
+	}
+
+	UInt_t one = 1;
+	if( *(char*)&one != 1 ){
+		GGM_analysis_log("WARN: cache files are little-endian, not written on this machine\n");
+		return kFALSE;
+	}
+
+	RawCacheHeader header;
+	memset(&header, 0, sizeof(header));
+	strcpy(header.magic, RAW_CACHE_MAGIC);
+	header.version = RAW_CACHE_VERSION;
+	header.channels = AVAILABLE_CHANNELS;
+	header.entries = store->entries;
+	header.source_size = raw_info->st_size;
+	header.source_mtime = raw_cache_mtime(raw_info);
+
+	for(Int_t ch=0; ch < AVAILABLE_CHANNELS; ch++){
+		const vector<Int_t> &adc = store->channel[ch];
+		Int_t min = store->entries > 0 ? adc[0] : 0;
+		Int_t max = min;
+		for(Long64_t k=0; k < store->entries; k++){
+			if( adc[k] < min ) min = adc[k];
+			if( adc[k] > max ) max = adc[k];
+		}
+		header.min[ch] = min;
+		header.max[ch] = max;
+	}
+
+	TString cache_path = raw_cache_path(raw_path);
+	TString temp_path = Form("%s.%d.tmp", cache_path.Data(), getpid());
+
+	FILE* f = fopen(temp_path.Data(), "wb");
+	if( f == NULL ){
+		GGM_analysis_log( Form("WARN: can't write cache %s\n", cache_path.Data()) );
+		return kFALSE;
+	}
+
+	Long64_t column_size = raw_cache_column_size(store->entries);
+	Long64_t padding = column_size - store->entries*sizeof(Int_t);
+	char zeros[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+
+	Bool_t ok = ( fwrite(&header, sizeof(header), 1, f) == 1 );
+	if( store->entries > 0 ){
+		ok = ok && fwrite(&store->event_id[0], sizeof(UInt_t), store->entries, f) == (size_t)store->entries;
+		ok = ok && fwrite(zeros, 1, padding, f) == (size_t)padding;
+		for(Int_t ch=0; ch < AVAILABLE_CHANNELS; ch++){
+			ok = ok && fwrite(&store->channel[ch][0], sizeof(Int_t), store->entries, f) == (size_t)store->entries;
+			ok = ok && fwrite(zeros, 1, padding, f) == (size_t)padding;
+		}
+	}
+	ok = ( fclose(f) == 0 ) && ok;
+
+	if( !ok || rename(temp_path.Data(), cache_path.Data()) != 0 ){
+		GGM_analysis_log( Form("WARN: can't write cache %s\n", cache_path.Data()) );
+		unlink(temp_path.Data());
+		return kFALSE;
+	}
+
+	GGM_analysis_log( Form("cache %s written\n", cache_path.Data()) );
+	return kTRUE;
+}
+
+
+/**
+* build the cache of a raw file if it is missing or stale
+*
+* @param TString path to the raw data file
+* @param Int_t number of parser threads, 0 means all the cores
+* @return boolean: true if the cache is fresh at the end
+**/
+Int_t build_raw_cache(TString raw_path, Int_t n_threads){
+
+	if( raw_cache_is_fresh(raw_path) ){
+		return kTRUE;
+	}
+
+	struct stat raw_info;
+	RawChannelStore* store = load_raw_file(raw_path, n_threads, &raw_info);
+	if( store == NULL ){
+		return kFALSE;
+	}
+
+	Int_t ok = write_raw_cache(raw_path, store, &raw_info);
+	delete store;
+
+	return ok;
+}
+
+
+/**
+* memory-map the cache of a raw file, only if it is fresh
+*
+* @param TString path to the raw data file
+* @return pointer to the open cache, to close with close_raw_cache, NULL if missing, stale or broken
+**/
+RawCacheFile* open_raw_cache(TString raw_path){
+
+	if( !raw_cache_is_fresh(raw_path) ){
+		return NULL;
+	}
+
+	TString cache_path = raw_cache_path(raw_path);
+	int fd = open(cache_path.Data(), O_RDONLY);
+	if( fd == -1 ){
+		return NULL;
+	}
+
+	struct stat cache_info;
+	if( fstat(fd, &cache_info) == -1 ){
+		close(fd);
+		return NULL;
+	}
+
+	char* data = (char*)mmap(NULL, cache_info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); //the mapping keeps the file open
+	if( data == MAP_FAILED ){
+		return NULL;
+	}
+
+	RawCacheFile* cache = new RawCacheFile();
+	cache->file_path = cache_path;
+	cache->data = data;
+	cache->size = cache_info.st_size;
+	cache->header = (const RawCacheHeader*)data;
+
+	Long64_t column_size = raw_cache_column_size(cache->header->entries);
+	if( cache->size != (Long64_t)sizeof(RawCacheHeader) + (AVAILABLE_CHANNELS+1)*column_size ){
+		GGM_analysis_log( Form("WARN: cache %s is truncated, ignored\n", cache_path.Data()) );
+		close_raw_cache(cache);
+		return NULL;
+	}
+
+	char* column = data + sizeof(RawCacheHeader);
+	cache->event_id = (const UInt_t*)column;
+	for(Int_t ch=0; ch < AVAILABLE_CHANNELS; ch++){
+		column += column_size;
+		cache->channel[ch] = (const Int_t*)column;
+	}
+
+	return cache;
+}
+
+
+/**
+* unmap and free a cache opened with open_raw_cache
+*
+* @param RawCacheFile* cache to close
+**/
+void close_raw_cache(RawCacheFile* cache){
+
+	if( cache == NULL ){
+		return;
+	}
+
+	munmap(cache->data, cache->size);
+	delete cache;
+}
+
+#endif
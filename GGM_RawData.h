@@ -0,0 +1,598 @@
+/*****
+*
+* header file with the native loader for GGM raw data files
+*
+* a raw file has 20 columns delimited by whitespaces, one event per line:
+*   event_id column_2 timestamp column_4 channel_1 ... channel_16
+* only event_id and the ADC channels are kept, in a columnar store
+*
+*******/
+#ifndef __GGM_RawData__ //header guard lock
+#define __GGM_RawData__
+
+#include <vector>
+#include <thread>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//ROOT headers
+#include "TMath.h"
+
+//custom headers
+#include "GGM_Analysis.h"
+#include "GGM_ThreadPool.h"
+
+
+#define RAW_COLUMNS 20 //how many columns in a raw data line
+#define RAW_CHANNEL_COLUMN 4 //column index (from zero) of channel_1
+#define RAW_STREAM_BUFFER (64*1024*1024) //bytes read at a time in streaming mode
+
+
+/*
+* struct type definition for the columnar store of a raw data file
+* channel[0] is channel_1, ADC values are integer counts
+*/
+typedef struct{
+   TString file_path;
+   Long64_t entries;
+   Long64_t bad_lines; //lines skipped because malformed
+   vector<UInt_t> event_id;
+   vector<Int_t> channel[AVAILABLE_CHANNELS];
+}RawChannelStore;
+
+/*
+* function called by stream_raw_file and parse_raw_file for each block of events
+*/
+typedef void (*RawBlockCallback)(RawChannelStore* block, void* user_data);
+
+/*
+* struct type definition for a raw data file read while it's still written
+* the partial last line is kept until it's completed
+*/
+typedef struct{
+   TString file_path;
+   int fd; //-1 while the file doesn't exist
+   dev_t device;
+   ino_t inode;
+   Long64_t offset; //bytes read
+   vector<char> partial; //last line without the end of line
+}RawTail;
+
+
+RawChannelStore* load_raw_file(TString file_path, Int_t n_threads = 0, struct stat* file_info = NULL);
+Long64_t parse_raw_file(TString file_path, RawBlockCallback callback, void* user_data, Int_t n_threads = 0);
+char* map_raw_file(TString file_path, struct stat* file_info);
+Long64_t stream_raw_file(TString file_path, RawBlockCallback callback, void* user_data, Int_t n_threads = 0, Long64_t buffer_size = RAW_STREAM_BUFFER);
+
+void parse_raw_buffer(const char* begin, const char* end, RawChannelStore* store, Int_t n_threads = 0);
+void parse_raw_chunks(const char* begin, const char* end, vector<RawChannelStore>* chunks, Int_t n_threads = 0);
+void parse_raw_chunk(const char* begin, const char* end, RawChannelStore* store);
+void clear_raw_store(RawChannelStore* store);
+
+void open_raw_tail(RawTail* tail, TString file_path);
+Long64_t read_raw_tail(RawTail* tail, RawChannelStore* block, Int_t* restarted, Int_t n_threads = 0, Long64_t max_bytes = RAW_STREAM_BUFFER);
+Long64_t flush_raw_tail(RawTail* tail, RawChannelStore* block);
+void close_raw_tail(RawTail* tail);
+
+
+
+/**
+* memory-map a raw data file and parse it in parallel in a columnar store
+*
+* @param TString path to the raw data file
+* @param Int_t number of parser threads, 0 means all the cores
+* @param struct stat* filled with size and mtime of the file before it was mapped, NULL for none
+* @return pointer to a new RawChannelStore, NULL if the file can't be read or has no events
+**/
+RawChannelStore* load_raw_file(TString file_path, Int_t n_threads, struct stat* file_info){
+
+	struct stat info;
+	if( file_info == NULL )
+		file_info = &info;
+
+	char* data = map_raw_file(file_path, file_info);
+	if( data == NULL ){
+		return NULL;
+	}
+
+	RawChannelStore* store = new RawChannelStore();
+	store->file_path = file_path;
+	clear_raw_store(store);
+
+	parse_raw_buffer(data, data + file_info->st_size, store, n_threads);
+
+	munmap(data, file_info->st_size);
+
+	if( store->bad_lines > 0 )
+		GGM_analysis_log( Form("WARN: %lld malformed lines skipped in %s\n", store->bad_lines, file_path.Data()) );
+
+	if( store->entries == 0 ){
+		delete store;
+		return NULL;
+	}
+
+	return store;
+}
+
+
+/**
+* memory-map a raw data file and parse it in parallel, the events of each parser thread
+* are passed to the callback in file order and freed, they are never merged in a single store
+*
+* @param TString path to the raw data file
+* @param RawBlockCallback function called for the events of each parser thread
+* @param void* pointer passed as it is to the callback
+* @param Int_t number of parser threads, 0 means all the cores
+* @return number of events read, -1 if the file can't be read
+**/
+Long64_t parse_raw_file(TString file_path, RawBlockCallback callback, void* user_data, Int_t n_threads){
+
+	struct stat file_info;
+	char* data = map_raw_file(file_path, &file_info);
+	if( data == NULL ){
+		return -1;
+	}
+
+	vector<RawChannelStore> chunks;
+	parse_raw_chunks(data, data + file_info.st_size, &chunks, n_threads);
+	munmap(data, file_info.st_size);
+
+	Long64_t total_entries = 0;
+	Long64_t total_bad_lines = 0;
+	for(UInt_t k=0; k < chunks.size(); k++){
+		chunks[k].file_path = file_path;
+		total_entries += chunks[k].entries;
+		total_bad_lines += chunks[k].bad_lines;
+
+		if( chunks[k].entries > 0 )
+			callback(&chunks[k], user_data);
+
+		chunks[k] = RawChannelStore(); //release the columns now
+	}
+
+	if( total_bad_lines > 0 )
+		GGM_analysis_log( Form("WARN: %lld malformed lines skipped in %s\n", total_bad_lines, file_path.Data()) );
+
+	return total_entries;
+}
+
+
+/**
+* memory-map a whole raw data file for reading, to unmap with munmap
+*
+* @param TString path to the raw data file
+* @param struct stat* filled with size and mtime of the file before it was mapped
+* @return first char of the mapped file, NULL if the file can't be read or is empty
+**/
+char* map_raw_file(TString file_path, struct stat* file_info){
+
+	int fd = open(file_path.Data(), O_RDONLY);
+	if( fd == -1 ){
+		GGM_analysis_log( Form("ERROR: can't open file %s\n", file_path.Data()) );
+		return NULL;
+	}
+
+	if( fstat(fd, file_info) == -1 || file_info->st_size == 0 ){
+		close(fd);
+		return NULL;
+	}
+
+	char* data = (char*)mmap(NULL, file_info->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); //the mapping keeps the file open
+	if( data == MAP_FAILED ){
+		GGM_analysis_log( Form("ERROR: can't map file %s in memory\n", file_path.Data()) );
+		return NULL;
+	}
+	madvise(data, file_info->st_size, MADV_SEQUENTIAL);
+
+	return data;
+}
+
+
+/**
+* read a raw data file in blocks of bounded size, for files bigger than the memory
+* each block is parsed in parallel and passed to the callback, then it's discarded
+*
+* @param TString path to the raw data file
+* @param RawBlockCallback function called for each block of events
+* @param void* pointer passed as it is to the callback
+* @param Int_t number of parser threads, 0 means all the cores
+* @param Long64_t bytes read at a time
+* @return number of events read, -1 if the file can't be read
+**/
+Long64_t stream_raw_file(TString file_path, RawBlockCallback callback, void* user_data, Int_t n_threads, Long64_t buffer_size){
+
+	int fd = open(file_path.Data(), O_RDONLY);
+	if( fd == -1 ){
+		GGM_analysis_log( Form("ERROR: can't open file %s\n", file_path.Data()) );
+		return -1;
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	vector<char> buffer(buffer_size);
+	Long64_t filled = 0; //bytes in buffer, the partial last line is kept for the next read
+	Long64_t total_entries = 0;
+	Long64_t total_bad_lines = 0;
+
+	RawChannelStore block;
+	block.file_path = file_path;
+	clear_raw_store(&block);
+
+	while( 1 ){
+		ssize_t n = read(fd, &buffer[filled], buffer_size - filled);
+		if( n < 0 ){
+			GGM_analysis_log( Form("ERROR: can't read file %s\n", file_path.Data()) );
+			close(fd);
+			return -1;
+		}
+
+		filled += n;
+		Bool_t last_read = (n == 0);
+
+		//parse only up to the last complete line, unless it is the end of file
+		Long64_t parse_end = filled;
+		if( !last_read ){
+			while( parse_end > 0 && buffer[parse_end-1] != '\n' )
+				parse_end--;
+
+			if( parse_end == 0 && filled == buffer_size ){ //a line longer than the buffer is not a valid line
+				total_bad_lines++;
+				filled = 0;
+				continue;
+			}
+		}
+
+		if( parse_end > 0 ){
+			parse_raw_buffer(&buffer[0], &buffer[0] + parse_end, &block, n_threads);
+			total_entries += block.entries;
+			total_bad_lines += block.bad_lines;
+
+			if( block.entries > 0 )
+				callback(&block, user_data);
+
+			clear_raw_store(&block);
+
+			memmove(&buffer[0], &buffer[parse_end], filled - parse_end);
+			filled -= parse_end;
+		}
+
+		if( last_read )
+			break;
+	}
+
+	close(fd);
+
+	if( total_bad_lines > 0 )
+		GGM_analysis_log( Form("WARN: %lld malformed lines skipped in %s\n", total_bad_lines, file_path.Data()) );
+
+	return total_entries;
+}
+
+
+/**
+* split a buffer on line boundaries and parse each piece in a different thread,
+* events are appended to the store in the same order as in the buffer
+* each piece is freed as soon as it's appended, an empty store takes the first piece without a copy
+*
+* @param const char* first char of the buffer
+* @param const char* one past the last char of the buffer
+* @param RawChannelStore* store to fill
+* @param Int_t number of parser threads, 0 means all the cores
+**/
+void parse_raw_buffer(const char* begin, const char* end, RawChannelStore* store, Int_t n_threads){
+
+	vector<RawChannelStore> chunks;
+	parse_raw_chunks(begin, end, &chunks, n_threads);
+
+	for(UInt_t k=0; k < chunks.size(); k++){
+		RawChannelStore *chunk = &chunks[k];
+		store->bad_lines += chunk->bad_lines;
+
+		if( store->entries == 0 ){
+			store->event_id.swap(chunk->event_id);
+			for(Int_t ch=0; ch < AVAILABLE_CHANNELS; ch++)
+				store->channel[ch].swap(chunk->channel[ch]);
+		}else if( chunk->entries > 0 ){
+			store->event_id.insert(store->event_id.end(), chunk->event_id.begin(), chunk->event_id.end());
+			for(Int_t ch=0; ch < AVAILABLE_CHANNELS; ch++)
+				store->channel[ch].insert(store->channel[ch].end(), chunk->channel[ch].begin(), chunk->channel[ch].end());
+		}
+		store->entries += chunk->entries;
+
+		*chunk = RawChannelStore(); //release the columns now
+	}
+}
+
+
+/**
+* split a buffer on line boundaries and parse each piece in a different thread,
+* chunks[k] has the events of piece k, pieces are in buffer order
+*
+* @param const char* first char of the buffer
+* @param const char* one past the last char of the buffer
+* @param vector<RawChannelStore>* stores of the pieces, resized to the number of pieces
+* @param Int_t number of parser threads, 0 means all the cores
+**/
+void parse_raw_chunks(const char* begin, const char* end, vector<RawChannelStore>* chunks, Int_t n_threads){
+
+	Long64_t size = end - begin;
+	n_threads = pool_threads(n_threads);
+
+	//small buffers are not worth a thread each
+	if( size < 1024*1024 || n_threads == 1 ){
+		chunks->resize(1);
+		clear_raw_store(&(*chunks)[0]);
+		parse_raw_chunk(begin, end, &(*chunks)[0]);
+		return;
+	}
+
+	//chunk boundaries, moved forward to the start of the next line
+	vector<const char*> bounds(n_threads+1);
+	bounds[0] = begin;
+	bounds[n_threads] = end;
+	for(Int_t k=1; k < n_threads; k++){
+		const char* p = begin + (size*k)/n_threads;
+		if( p < bounds[k-1] )
+			p = bounds[k-1];
+		const char* nl = (const char*)memchr(p, '\n', end - p);
+		bounds[k] = (nl == NULL) ? end : nl + 1;
+	}
+
+	chunks->resize(n_threads);
+	vector<std::thread> workers;
+	for(Int_t k=0; k < n_threads; k++){
+		clear_raw_store(&(*chunks)[k]);
+		workers.push_back( std::thread(parse_raw_chunk, bounds[k], bounds[k+1], &(*chunks)[k]) );
+	}
+	for(Int_t k=0; k < n_threads; k++)
+		workers[k].join();
+}
+
+
+/**
+* parse a piece of raw file made of whole lines and append the events to the store
+* empty lines and lines starting with # are ignored, lines with less than RAW_COLUMNS numbers are skipped
+*
+* @param const char* first char of the first line
+* @param const char* one past the last char of the last line
+* @param RawChannelStore* store to fill
+**/
+void parse_raw_chunk(const char* begin, const char* end, RawChannelStore* store){
+
+	const char* p = begin;
+	Double_t column[RAW_COLUMNS];
+
+	//rough guess of the number of lines, to avoid reallocations
+	Long64_t guess = store->entries + (end - begin)/(RAW_COLUMNS*5);
+	store->event_id.reserve(guess);
+	for(Int_t ch=0; ch < AVAILABLE_CHANNELS; ch++)
+		store->channel[ch].reserve(guess);
+
+	while( p < end ){
+
+		const char* eol = (const char*)memchr(p, '\n', end - p);
+		if( eol == NULL )
+			eol = end;
+
+		//skip leading whitespaces, blank and comment lines
+		while( p < eol && (*p == ' ' || *p == '\t' || *p == '\r') )
+			p++;
+		if( p == eol || *p == '#' ){
+			p = eol + 1;
+			continue;
+		}
+
+		Int_t n_col = 0;
+		while( p < eol && n_col < RAW_COLUMNS ){
+
+			//fast path for integer numbers, fallback to strtod for anything else
+			const char* start = p;
+			Bool_t negative = kFALSE;
+			if( *p == '-' || *p == '+' ){
+				negative = (*p == '-');
+				p++;
+			}
+			Long64_t value = 0;
+			const char* digits = p;
+			while( p < eol && *p >= '0' && *p <= '9' ){
+				value = value*10 + (*p - '0');
+				p++;
+			}
+
+			if( p > digits && (p == eol || *p == ' ' || *p == '\t' || *p == '\r') ){
+				column[n_col] = negative ? -value : value;
+			}else{
+				//copy the token, the buffer is not null terminated
+				char token[64];
+				const char* token_end = start;
+				while( token_end < eol && *token_end != ' ' && *token_end != '\t' && *token_end != '\r' )
+					token_end++;
+				if( token_end - start >= (Long64_t)sizeof(token) )
+					break; //not a number
+				memcpy(token, start, token_end - start);
+				token[token_end - start] = '\0';
+
+				char* stop;
+				column[n_col] = strtod(token, &stop);
+				if( stop != token + (token_end - start) )
+					break; //not a number
+				p = token_end;
+			}
+			n_col++;
+
+			while( p < eol && (*p == ' ' || *p == '\t' || *p == '\r') )
+				p++;
+		}
+
+		if( n_col == RAW_COLUMNS ){
+			store->event_id.push_back( (UInt_t)column[0] );
+			for(Int_t ch=0; ch < AVAILABLE_CHANNELS; ch++)
+				store->channel[ch].push_back( TMath::Nint(column[RAW_CHANNEL_COLUMN+ch]) );
+			store->entries++;
+		}else{
+			store->bad_lines++;
+		}
+
+		p = eol + 1;
+	}
+}
+
+
+/**
+* empty a store keeping its file path
+*
+* @param RawChannelStore* store to clear
+**/
+void clear_raw_store(RawChannelStore* store){
+
+	store->entries = 0;
+	store->bad_lines = 0;
+	store->event_id.clear();
+	for(Int_t ch=0; ch < AVAILABLE_CHANNELS; ch++)
+		store->channel[ch].clear();
+}
+
+
+/**
+* start following a raw data file from its beginning, it may not exist yet
+*
+* @param RawTail* tail to initialize
+* @param TString path to the raw data file
+**/
+void open_raw_tail(RawTail* tail, TString file_path){
+
+	tail->file_path = file_path;
+	tail->fd = -1;
+	tail->device = 0;
+	tail->inode = 0;
+	tail->offset = 0;
+	tail->partial.clear();
+}
+
+
+/**
+* read the events written in a followed raw file since the last call, only complete lines are parsed
+* if the file is truncated or replaced by a new one (rotation) it's read again from the beginning,
+* restarted is set and the caller must discard the events of the old file
+*
+* @param RawTail* tail of the file
+* @param RawChannelStore* store where the new events are appended
+* @param Int_t* boolean, set to true if the file restarted from the beginning
+* @param Int_t number of parser threads, 0 means all the cores
+* @param Long64_t max bytes read in a call
+* @return number of new events, -1 if the file can't be read
+**/
+Long64_t read_raw_tail(RawTail* tail, RawChannelStore* block, Int_t* restarted, Int_t n_threads, Long64_t max_bytes){
+
+	*restarted = kFALSE;
+
+	//a different file at the same path is a rotation
+	struct stat path_info;
+	Bool_t exists = ( stat(tail->file_path.Data(), &path_info) == 0 );
+	if( tail->fd != -1 && exists && (path_info.st_ino != tail->inode || path_info.st_dev != tail->device) ){
+		GGM_analysis_log( Form("WARN: %s was replaced, reading it from the beginning\n", tail->file_path.Data()) );
+		close_raw_tail(tail);
+		*restarted = kTRUE;
+	}
+
+	if( tail->fd == -1 ){
+		if( !exists )
+			return 0; //not written yet
+
+		tail->fd = open(tail->file_path.Data(), O_RDONLY);
+		if( tail->fd == -1 ){
+			GGM_analysis_log( Form("ERROR: can't open file %s\n", tail->file_path.Data()) );
+			return -1;
+		}
+		tail->device = path_info.st_dev;
+		tail->inode = path_info.st_ino;
+		tail->offset = 0;
+		tail->partial.clear();
+	}
+
+	struct stat info;
+	if( fstat(tail->fd, &info) == -1 ){
+		GGM_analysis_log( Form("ERROR: can't read file %s\n", tail->file_path.Data()) );
+		return -1;
+	}
+
+	//smaller than what was read: truncated
+	if( info.st_size < tail->offset ){
+		GGM_analysis_log( Form("WARN: %s was truncated, reading it from the beginning\n", tail->file_path.Data()) );
+		tail->offset = 0;
+		tail->partial.clear();
+		*restarted = kTRUE;
+	}
+
+	Long64_t to_read = TMath::Min((Long64_t)info.st_size - tail->offset, max_bytes);
+	if( to_read <= 0 )
+		return 0;
+
+	//new bytes after the partial line of the last call
+	vector<char> &buffer = tail->partial;
+	Long64_t filled = buffer.size();
+	buffer.resize(filled + to_read);
+	ssize_t n = pread(tail->fd, &buffer[filled], to_read, tail->offset);
+	if( n < 0 ){
+		buffer.resize(filled);
+		GGM_analysis_log( Form("ERROR: can't read file %s\n", tail->file_path.Data()) );
+		return -1;
+	}
+	buffer.resize(filled + n);
+	tail->offset += n;
+
+	//parse only up to the last complete line
+	Long64_t parse_end = buffer.size();
+	while( parse_end > 0 && buffer[parse_end-1] != '\n' )
+		parse_end--;
+
+	Long64_t entries = block->entries;
+	if( parse_end > 0 ){
+		parse_raw_buffer(&buffer[0], &buffer[0] + parse_end, block, n_threads);
+		buffer.erase(buffer.begin(), buffer.begin() + parse_end);
+	}
+
+	return block->entries - entries;
+}
+
+
+/**
+* parse the partial last line of a followed file, when the file is known to be complete
+*
+* @param RawTail* tail of the file
+* @param RawChannelStore* store where the event is appended
+* @return number of new events, 0 or 1
+**/
+Long64_t flush_raw_tail(RawTail* tail, RawChannelStore* block){
+
+	Long64_t entries = block->entries;
+	if( !tail->partial.empty() ){
+		parse_raw_chunk(&tail->partial[0], &tail->partial[0] + tail->partial.size(), block);
+		tail->partial.clear();
+	}
+
+	return block->entries - entries;
+}
+
+
+/**
+* stop following a raw file
+*
+* @param RawTail* tail of the file
+**/
+void close_raw_tail(RawTail* tail){
+
+	if( tail->fd != -1 )
+		close(tail->fd);
+
+	tail->fd = -1;
+	tail->offset = 0;
+	tail->partial.clear();
+}
+
+#endif
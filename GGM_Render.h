@@ -0,0 +1,288 @@
+/*****
+*
+* header file with the rendering of the report pages
+*
+* pages are numbered from 0, each one is drawn by a function given by the caller
+* when it is marked ready, and always written in page order:
+*   sync     pages are drawn and written by finish_renderer, in the caller thread
+*   async    a rendering thread of the report draws each page as soon as it's ready,
+*            ROOT thread safety and batch mode are enabled when it starts
+*   headless nothing is drawn
+* with format pdf the pages are a multipage PDF, written when the last page is drawn,
+* with png or svg every page is a file <output>_<canvas name>.<format>, written when drawn
+* the output lock is held only while files are written, ROOT keeps one PDF open at a time
+* canvases of concurrent reports are drawn at the same time, so each report gives its canvases
+* names starting with its own canvas_prefix: ROOT deletes a canvas when another one gets its name
+*
+*******/
+#ifndef __GGM_Render__ //header guard lock
+#define __GGM_Render__
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+//ROOT headers
+#include "TROOT.h"
+#include "TCanvas.h"
+#include "TList.h"
+
+//custom headers
+#include "GGM_Analysis.h"
+#include "GGM_Stats.h"
+
+
+#define RENDER_SYNC 0
+#define RENDER_ASYNC 1
+#define RENDER_HEADLESS 2
+
+
+/*
+* struct type definition for the rendering of the pages of a report
+*/
+typedef struct{
+   Int_t mode; //RENDER_SYNC, RENDER_ASYNC or RENDER_HEADLESS
+   TString output_filename;
+   TString format; //pdf, png or svg
+   TString canvas_prefix; //unique for each renderer, to start the names of its canvases
+   Int_t n_pages;
+   Int_t keep_canvases; //only in sync mode with pdf format, canvases are added to canvases instead of deleted
+   std::function<TCanvas*(Int_t)> draw_page; //draw page k in a new canvas, NULL if page k is empty
+   std::mutex* output_lock; //held only while writing files, ROOT keeps one PDF open at a time
+   std::mutex lock;
+   std::condition_variable page_cv;
+   vector<Int_t> ready;
+   std::thread thread;
+   Int_t written; //pages written
+   RunStats* stats; //render stage of the run, NULL for none
+   TList canvases;
+}Renderer;
+
+
+void start_renderer(Renderer* renderer, Int_t mode, TString output_filename, TString format, Int_t n_pages, std::function<TCanvas*(Int_t)> draw_page, std::mutex* output_lock, Int_t keep_canvases = kFALSE, RunStats* stats = NULL);
+void page_ready(Renderer* renderer, Int_t page);
+Int_t finish_renderer(Renderer* renderer);
+void render_pages(Renderer* renderer);
+void make_output_dir(TString file_path);
+Int_t render_mode(TString mode_name);
+TString page_filename(Renderer* renderer, TCanvas* canvas);
+
+
+/******
+*
+* global variable
+*******/
+std::atomic<Int_t> gGGM_Renderers(0); //renderers started, for the canvas prefixes
+
+
+
+/**
+* prepare the rendering of a report, in async mode the rendering thread starts waiting for pages
+*
+* @param Renderer* renderer to start
+* @param Int_t RENDER_SYNC, RENDER_ASYNC or RENDER_HEADLESS
+* @param TString path of the PDF, or of the first part of the images names
+* @param TString pdf, png or svg
+* @param Int_t number of pages
+* @param std::function<TCanvas*(Int_t)> draw page k in a new canvas named with renderer->canvas_prefix, called only in the rendering thread
+* @param std::mutex* lock held while writing, NULL for none
+* @param Int_t boolean: keep the canvases in renderer->canvases, only for sync mode and pdf format
+* @param RunStats* stats where the time of drawing and writing the pages is added, NULL for none
+**/
+void start_renderer(Renderer* renderer, Int_t mode, TString output_filename, TString format, Int_t n_pages, std::function<TCanvas*(Int_t)> draw_page, std::mutex* output_lock, Int_t keep_canvases, RunStats* stats){
+
+	renderer->mode = mode;
+	renderer->output_filename = output_filename;
+	renderer->format = format;
+	renderer->format.ToLower();
+	renderer->canvas_prefix = Form("r%d_", (Int_t)++gGGM_Renderers);
+	renderer->n_pages = n_pages;
+	renderer->keep_canvases = keep_canvases && mode == RENDER_SYNC && renderer->format == "pdf";
+	renderer->draw_page = draw_page;
+	renderer->output_lock = output_lock;
+	renderer->ready.assign(n_pages, kFALSE);
+	renderer->written = 0;
+	renderer->stats = stats;
+
+	if( renderer->format != "pdf" && renderer->format != "png" && renderer->format != "svg" ){
+		GGM_analysis_log( Form("WARN: unknown image format %s, pdf used\n", format.Data()) );
+		renderer->format = "pdf";
+	}
+
+	if( mode == RENDER_ASYNC ){
+		ROOT::EnableThreadSafety(); //the rendering thread and the analysis both use ROOT
+		gROOT->SetBatch(kTRUE); //canvases are created outside the main thread, they can't be shown
+		renderer->thread = std::thread(render_pages, renderer);
+	}
+}
+
+
+/**
+* mark a page as ready to be drawn, it can be called from any thread
+*
+* @param Renderer* renderer of the report
+* @param Int_t page number, from 0
+**/
+void page_ready(Renderer* renderer, Int_t page){
+
+	std::lock_guard<std::mutex> guard(renderer->lock);
+	renderer->ready[page] = kTRUE;
+	renderer->page_cv.notify_one();
+}
+
+
+/**
+* wait until every page is written, in sync mode the pages are drawn and written now
+* every page must have been marked ready
+*
+* @param Renderer* renderer of the report
+* @return number of pages written
+**/
+Int_t finish_renderer(Renderer* renderer){
+
+	if( renderer->mode == RENDER_ASYNC ){
+		renderer->thread.join();
+	}else if( renderer->mode == RENDER_SYNC ){
+		render_pages(renderer);
+	}
+
+	return renderer->written;
+}
+
+
+/**
+* draw and write the pages in page order, waiting for each one to be ready
+* images are written and deleted as soon as they are drawn, the pages of a PDF
+* are kept until the last one is drawn and then written all together
+* the output lock is never held while waiting for a page
+*
+* @param Renderer* renderer of the report
+**/
+void render_pages(Renderer* renderer){
+
+	gErrorIgnoreLevel=1; //impedisce che vengano stampati messaggi di avvisi sulla linea di comando
+
+	TString file_path = renderer->output_filename;
+	Bool_t pdf = ( renderer->format == "pdf" );
+	vector<TCanvas*> pages; //pages of the PDF, drawn and not written yet
+
+	for(Int_t k=0; k < renderer->n_pages; k++){
+
+		{
+			std::unique_lock<std::mutex> guard(renderer->lock);
+			while( !renderer->ready[k] )
+				renderer->page_cv.wait(guard);
+		}
+
+		Long64_t start = stage_start();
+		TCanvas *canvas = renderer->draw_page(k);
+		if( canvas == NULL )
+			continue;
+
+		if( pdf ){
+			pages.push_back(canvas);
+			stage_stop(renderer->stats, STAGE_RENDER, start, 1);
+			continue;
+		}
+
+		TString page_path = page_filename(renderer, canvas);
+		{
+			std::unique_lock<std::mutex> output_guard;
+			if( renderer->output_lock != NULL )
+				output_guard = std::unique_lock<std::mutex>(*renderer->output_lock);
+
+			if( renderer->written == 0 )
+				make_output_dir(file_path);
+			canvas->Print( page_path.Data() );
+		}
+		delete canvas;
+		stage_stop(renderer->stats, STAGE_RENDER, start, 1, file_size(page_path));
+
+		renderer->written++;
+	}
+
+	if( !pages.empty() ){
+		Long64_t start = stage_start();
+		{
+			std::unique_lock<std::mutex> output_guard;
+			if( renderer->output_lock != NULL )
+				output_guard = std::unique_lock<std::mutex>(*renderer->output_lock);
+
+			make_output_dir(file_path);
+			pages.front()->Print( Form("%s[", file_path.Data()) ); //open the file without writing a page
+			for(UInt_t k=0; k < pages.size(); k++)
+				pages[k]->Print( file_path.Data() );
+			pages.back()->Print( Form("%s]", file_path.Data()) ); //close the file
+		}
+
+		for(UInt_t k=0; k < pages.size(); k++){
+			if( renderer->keep_canvases )
+				renderer->canvases.Add(pages[k]);
+			else
+				delete pages[k];
+		}
+		renderer->written = pages.size();
+		stage_stop(renderer->stats, STAGE_RENDER, start, 0, file_size(file_path));
+	}
+
+	if( renderer->written == 0 )
+		GGM_analysis_log("No canvas to save\n\n");
+}
+
+
+/**
+* create the directory of an output file, if not exists
+*
+* @param TString path of the output file
+**/
+void make_output_dir(TString file_path){
+
+	TString dir = gSystem->DirName(file_path);
+	if( gSystem->AccessPathName(dir) ) //retun true if NOT exists
+		if( gSystem->mkdir( dir , kTRUE) == -1)
+			GGM_analysis_log( Form("ERROR: can't create directory %s\n", dir.Data()) );
+}
+
+
+/**
+* @param TString render-mode in the configuration file: sync, async or headless
+* @return RENDER_SYNC, RENDER_ASYNC or RENDER_HEADLESS, RENDER_SYNC if unknown
+**/
+Int_t render_mode(TString mode_name){
+
+	mode_name.ToLower();
+
+	if( mode_name == "async" )
+		return RENDER_ASYNC;
+	if( mode_name == "headless" )
+		return RENDER_HEADLESS;
+	if( mode_name != "sync" )
+		GGM_analysis_log( Form("WARN: unknown render mode %s, sync used\n", mode_name.Data()) );
+
+	return RENDER_SYNC;
+}
+
+
+/**
+* @param Renderer* renderer of the report
+* @param TCanvas* canvas of the page
+* @return path of the image of a page: output file without extension, canvas name without the prefix and format
+**/
+TString page_filename(Renderer* renderer, TCanvas* canvas){
+
+	TString base = renderer->output_filename;
+	Ssiz_t dot = base.Last('.');
+	if( dot != kNPOS && base.Index("/", dot) == kNPOS )
+		base.Remove(dot);
+
+	TString name = canvas->GetName();
+	if( name.BeginsWith(renderer->canvas_prefix) )
+		name.Remove(0, renderer->canvas_prefix.Length());
+
+	return Form("%s_%s.%s", base.Data(), name.Data(), renderer->format.Data());
+}
+
+#endif
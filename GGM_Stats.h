@@ -0,0 +1,233 @@
+/*****
+*
+* header file with timers and counters of the analysis stages
+*
+* each stage counts calls, wall time, events and bytes, the counters are atomic
+* so channels analyzed in parallel add to the same stats
+* the stats of a run are written as a JSON line by write_run_stats
+*
+*******/
+#ifndef __GGM_Stats__ //header guard lock
+#define __GGM_Stats__
+
+#include <atomic>
+#include <chrono>
+
+#include <sys/stat.h>
+
+//ROOT headers
+#include "TMath.h"
+
+//custom headers
+#include "GGM_Analysis.h"
+#include "GGM_DST.h"
+
+
+#define STAGE_LOAD 0 //raw file read and counted
+#define STAGE_OUTLIERS 1 //outlier removal of the pedestal
+#define STAGE_VALIDITY 2 //check of dead and noisy channels
+#define STAGE_HISTOGRAM 3 //pedestal and total signal histograms
+#define STAGE_EFFICIENCY 4 //scale, difference and efficiency
+#define STAGE_DST 5 //DST write
+#define STAGE_RENDER 6 //canvases and report
+#define N_STAGES 7
+
+
+/*
+* struct type definition for the counters of a stage
+*/
+typedef struct{
+   std::atomic<Long64_t> calls;
+   std::atomic<Long64_t> nanoseconds;
+   std::atomic<Long64_t> events;
+   std::atomic<Long64_t> bytes;
+}StageCounter;
+
+/*
+* struct type definition for the counters of all the stages of a run, or of a pedestal
+*/
+typedef struct{
+   StageCounter stage[N_STAGES];
+}RunStats;
+
+
+void clear_run_stats(RunStats* stats);
+Long64_t stage_start();
+void stage_stop(RunStats* stats, Int_t stage, Long64_t start, Long64_t events = 0, Long64_t bytes = 0);
+void stage_add(RunStats* stats, Int_t stage, Long64_t nanoseconds, Long64_t events = 0, Long64_t bytes = 0);
+TString stage_name(Int_t stage);
+TString run_stats_json(RunStats* stats);
+Int_t write_run_stats(TString file_path, TString json);
+TString json_string(TString value);
+TString json_number(Double_t value);
+Long64_t file_size(TString file_path);
+
+
+
+/**
+* @param RunStats* stats to set to zero
+**/
+void clear_run_stats(RunStats* stats){
+
+	for(Int_t s=0; s < N_STAGES; s++){
+		stats->stage[s].calls = 0;
+		stats->stage[s].nanoseconds = 0;
+		stats->stage[s].events = 0;
+		stats->stage[s].bytes = 0;
+	}
+}
+
+
+/**
+* @return current time for stage_stop, in ns
+**/
+Long64_t stage_start(){
+
+	return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+
+/**
+* add a call of a stage, from stage_start to now
+*
+* @param RunStats* stats of the run, NULL for none
+* @param Int_t stage, STAGE_LOAD ... STAGE_RENDER
+* @param Long64_t time returned by stage_start
+* @param Long64_t events processed
+* @param Long64_t bytes processed
+**/
+void stage_stop(RunStats* stats, Int_t stage, Long64_t start, Long64_t events, Long64_t bytes){
+
+	if( stats == NULL ){
+		return;
+	}
+
+	stage_add(stats, stage, stage_start() - start, events, bytes);
+}
+
+
+/**
+* add a call of a stage, timed by the caller
+*
+* @param RunStats* stats of the run, NULL for none
+* @param Int_t stage, STAGE_LOAD ... STAGE_RENDER
+* @param Long64_t wall time of the call in ns
+* @param Long64_t events processed
+* @param Long64_t bytes processed
+**/
+void stage_add(RunStats* stats, Int_t stage, Long64_t nanoseconds, Long64_t events, Long64_t bytes){
+
+	if( stats == NULL ){
+		return;
+	}
+
+	stats->stage[stage].calls++;
+	stats->stage[stage].nanoseconds += nanoseconds;
+	stats->stage[stage].events += events;
+	stats->stage[stage].bytes += bytes;
+}
+
+
+/**
+* @param Int_t stage, STAGE_LOAD ... STAGE_RENDER
+* @return name of the stage in the JSON report
+**/
+TString stage_name(Int_t stage){
+
+	const char* names[N_STAGES] = {"load", "outliers", "validity", "histogram", "efficiency", "dst", "render"};
+
+	return names[stage];
+}
+
+
+/**
+* @param RunStats* stats of a run
+* @return JSON object with an object for each stage: calls, seconds, events, bytes, events/s, bytes/s
+**/
+TString run_stats_json(RunStats* stats){
+
+	TString json = "{";
+	for(Int_t s=0; s < N_STAGES; s++){
+		StageCounter *counter = &stats->stage[s];
+		Double_t seconds = counter->nanoseconds*1e-9;
+
+		json += Form("%s\"%s\":{\"calls\":%lld,\"seconds\":%.6f,\"events\":%lld,\"bytes\":%lld,\"events_per_s\":%.6g,\"bytes_per_s\":%.6g}",
+			s > 0 ? "," : "", stage_name(s).Data(),
+			(Long64_t)counter->calls, seconds, (Long64_t)counter->events, (Long64_t)counter->bytes,
+			seconds > 0 ? counter->events/seconds : 0, seconds > 0 ? counter->bytes/seconds : 0);
+	}
+	json += "}";
+
+	return json;
+}
+
+
+/**
+* append a JSON report as a line of a file, one line per run
+*
+* @param TString path of the file
+* @param TString JSON object, on a single line
+* @return boolean: true if written
+**/
+Int_t write_run_stats(TString file_path, TString json){
+
+	json += "\n";
+	if( !append_to_file(file_path, json.Data(), json.Length()) ){
+		GGM_analysis_log( Form("WARN: can't write stats file %s\n", file_path.Data()) );
+		return kFALSE;
+	}
+
+	return kTRUE;
+}
+
+
+/**
+* @param TString value
+* @return value as a JSON string, with quotes and escapes
+**/
+TString json_string(TString value){
+
+	TString json = "\"";
+	for(Ssiz_t k=0; k < value.Length(); k++){
+		char c = value[k];
+		if( c == '"' || c == '\\' )
+			json += Form("\\%c", c);
+		else if( (unsigned char)c < 0x20 )
+			json += Form("\\u%04x", c);
+		else
+			json += Form("%c", c);
+	}
+	json += "\"";
+
+	return json;
+}
+
+
+/**
+* @param Double_t value
+* @return value as a JSON number, null if it's NaN or infinite
+**/
+TString json_number(Double_t value){
+
+	if( !TMath::Finite(value) )
+		return "null";
+
+	return Form("%.9g", value);
+}
+
+
+/**
+* @param TString path of a file
+* @return size of the file in bytes, 0 if it doesn't exist
+**/
+Long64_t file_size(TString file_path){
+
+	struct stat info;
+	if( stat(file_path.Data(), &info) == -1 ){
+		return 0;
+	}
+
+	return info.st_size;
+}
+
+#endif
@@ -0,0 +1,123 @@
+/*****
+*
+* header file with a small work-stealing pool for independent tasks
+*
+* tasks are numbered from 0, each worker starts from its own block of tasks
+* and when it's done it steals from the end of the blocks of the others
+*
+*******/
+#ifndef __GGM_ThreadPool__ //header guard lock
+#define __GGM_ThreadPool__
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <functional>
+
+//ROOT headers
+#include "TROOT.h"
+
+
+/*
+* struct type definition for the queue of tasks of a worker
+*/
+typedef struct{
+   std::mutex lock;
+   std::deque<Int_t> tasks;
+}WorkerQueue;
+
+
+void run_parallel(Int_t n_tasks, Int_t n_threads, std::function<void(Int_t)> task);
+Bool_t next_task(std::vector<WorkerQueue>& queues, Int_t worker, Int_t* task);
+Int_t pool_threads(Int_t n_threads);
+
+
+
+/**
+* run task(0) ... task(n_tasks-1) on n_threads threads, the caller thread is one of them
+* return when all the tasks are done
+*
+* @param Int_t number of tasks
+* @param Int_t number of threads, 0 means all the cores
+* @param std::function<void(Int_t)> function called with the task number
+**/
+void run_parallel(Int_t n_tasks, Int_t n_threads, std::function<void(Int_t)> task){
+
+	n_threads = pool_threads(n_threads);
+	if( n_threads > n_tasks )
+		n_threads = n_tasks;
+
+	if( n_threads <= 1 ){
+		for(Int_t k=0; k < n_tasks; k++)
+			task(k);
+		return;
+	}
+
+	//each worker gets a contiguous block of tasks
+	std::vector<WorkerQueue> queues(n_threads);
+	for(Int_t k=0; k < n_tasks; k++)
+		queues[ (Long64_t)k*n_threads/n_tasks ].tasks.push_back(k);
+
+	auto worker = [&](Int_t w){
+		Int_t k;
+		while( next_task(queues, w, &k) )
+			task(k);
+	};
+
+	std::vector<std::thread> workers;
+	for(Int_t w=1; w < n_threads; w++)
+		workers.push_back( std::thread(worker, w) );
+	worker(0);
+	for(UInt_t w=0; w < workers.size(); w++)
+		workers[w].join();
+}
+
+
+/**
+* take the next task of a worker from the front of its queue,
+* or steal one from the back of another queue when its own is empty
+*
+* @param std::vector<WorkerQueue>& queues of all the workers
+* @param Int_t index of the worker asking for a task
+* @param Int_t* task number, filled if a task is found
+* @return true if a task was found, false when all the queues are empty
+**/
+Bool_t next_task(std::vector<WorkerQueue>& queues, Int_t worker, Int_t* task){
+
+	Int_t n_queues = queues.size();
+
+	for(Int_t i=0; i < n_queues; i++){
+		Int_t q = (worker + i) % n_queues;
+		std::lock_guard<std::mutex> guard(queues[q].lock);
+
+		if( queues[q].tasks.empty() )
+			continue;
+
+		if( q == worker ){
+			*task = queues[q].tasks.front();
+			queues[q].tasks.pop_front();
+		}else{
+			*task = queues[q].tasks.back();
+			queues[q].tasks.pop_back();
+		}
+		return kTRUE;
+	}
+
+	return kFALSE;
+}
+
+
+/**
+* @param Int_t requested number of threads, 0 or negative means all the cores
+* @return number of threads to use, at least one
+**/
+Int_t pool_threads(Int_t n_threads){
+
+	if( n_threads <= 0 )
+		n_threads = std::thread::hardware_concurrency();
+
+	return n_threads > 0 ? n_threads : 1;
+}
+
+#endif